@@ -0,0 +1,125 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// fastCopyBenchmark
+// -----------------
+//
+// Copies fed sized blocks like the builder (fed data into event chunks) and
+// the sender (event data into i2o frames), with memcpy and with the
+// non-temporal stores of FastCopy, and prints the bandwidth of both.
+//
+//   autoBUFastCopyBenchmark [fedSize [nbFeds [memoryMB [ntCopyThreshold [frameSize]]]]]
+//
+// defaults: 2048 bytes, 512 feds per event, 1024 MB of events (larger than
+// the last level cache), threshold 512, frames of 4096 bytes
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "EventFilter/AutoBU/interface/FastCopy.h"
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <cstdlib>
+#include <stdint.h>
+#include <sys/time.h>
+
+
+using namespace std;
+using namespace evf;
+
+
+namespace {
+
+  double now()
+  {
+    struct timeval tv;
+    gettimeofday(&tv,0);
+    return tv.tv_sec+tv.tv_usec*1e-6;
+  }
+
+
+  // fed data of one event into consecutive event memory, 8 byte aligned
+  double build(const vector<unsigned char>& feds,unsigned int fedSize,
+	       unsigned int nbFeds,vector<unsigned char>& events)
+  {
+    unsigned int alignedSize=(fedSize+7)&~7U;
+    uint64_t     evtSize    =(uint64_t)alignedSize*nbFeds;
+    uint64_t     nbEvents   =events.size()/evtSize;
+    double       start      =now();
+    for (uint64_t iEvt=0;iEvt<nbEvents;iEvt++) {
+      unsigned char* dst=&events[iEvt*evtSize];
+      for (unsigned int i=0;i<nbFeds;i++,dst+=alignedSize)
+	FastCopy::copy(dst,&feds[(i%16)*alignedSize],fedSize);
+    }
+    return nbEvents*evtSize/(now()-start)/1048576.0;
+  }
+
+
+  // event data into frames of frameSize, the frames are recycled
+  double send(const vector<unsigned char>& events,unsigned int fedSize,
+	      unsigned int nbFeds,unsigned int frameSize,
+	      vector<unsigned char>& frames)
+  {
+    unsigned int alignedSize=(fedSize+7)&~7U;
+    uint64_t     evtSize    =(uint64_t)alignedSize*nbFeds;
+    uint64_t     nbEvents   =events.size()/evtSize;
+    uint64_t     nbFrames   =frames.size()/frameSize;
+    uint64_t     iFrame     =0;
+    double       start      =now();
+    for (uint64_t iEvt=0;iEvt<nbEvents;iEvt++) {
+      const unsigned char* src=&events[iEvt*evtSize];
+      uint64_t left=evtSize;
+      while (left>0) {
+	unsigned int n=(left<frameSize) ? left : frameSize;
+	FastCopy::copy(&frames[(iFrame++%nbFrames)*frameSize],src,n);
+	src +=n;
+	left-=n;
+      }
+    }
+    return nbEvents*evtSize/(now()-start)/1048576.0;
+  }
+
+}
+
+
+//______________________________________________________________________________
+int main(int argc,char** argv)
+{
+  unsigned int fedSize  =(argc>1) ? atoi(argv[1]) : 2048;
+  unsigned int nbFeds   =(argc>2) ? atoi(argv[2]) : 512;
+  unsigned int memoryMB =(argc>3) ? atoi(argv[3]) : 1024;
+  unsigned int threshold=(argc>4) ? atoi(argv[4]) : 512;
+  unsigned int frameSize=(argc>5) ? atoi(argv[5]) : 4096;
+  if (0==fedSize||0==nbFeds||0==frameSize||0==threshold||
+      (uint64_t)memoryMB<<20<(uint64_t)((fedSize+7)&~7U)*nbFeds) {
+    cerr<<"usage: "<<argv[0]
+	<<" [fedSize [nbFeds [memoryMB [ntCopyThreshold [frameSize]]]]]"<<endl;
+    return 1;
+  }
+
+  // 16 distinct source feds, as for PLAYBACK events read from file
+  vector<unsigned char> feds(16*((fedSize+7)&~7U));
+  for (unsigned int i=0;i<feds.size();i++) feds[i]=i*2654435761U>>24;
+  vector<unsigned char> events((uint64_t)memoryMB<<20,0);
+  vector<unsigned char> frames(1024*frameSize,0);
+
+  cout<<"fedSize "<<fedSize<<", "<<nbFeds<<" feds per event, "
+      <<memoryMB<<" MB of events, frames of "<<frameSize<<" bytes"<<endl;
+  cout<<setw(24)<<left<<"kernel"<<setw(16)<<"build MB/s"<<"send MB/s"<<endl;
+
+  // the first pass of each configuration only faults the pages in
+  for (unsigned int i=0;i<2;i++) {
+    FastCopy::configure(0==i ? 0 : threshold);
+    build(feds,fedSize,nbFeds,events);
+    send(events,fedSize,nbFeds,frameSize,frames);
+    double buildMBs=build(feds,fedSize,nbFeds,events);
+    double sendMBs =send(events,fedSize,nbFeds,frameSize,frames);
+    ostringstream kernel;
+    if (0==FastCopy::threshold()) kernel<<"memcpy";
+    else kernel<<FastCopy::kernelName()<<" >= "<<FastCopy::threshold();
+    cout<<setw(24)<<left<<kernel.str()<<setw(16)<<fixed<<setprecision(0)
+	<<buildMBs<<sendMBs<<endl;
+  }
+  return 0;
+}
@@ -3,6 +3,22 @@
 
 
 #include "EventFilter/AutoBU/interface/BUEvent.h"
+#include "EventFilter/AutoBU/interface/ReplayCache.h"
+#include "EventFilter/AutoBU/interface/EventSampler.h"
+#include "EventFilter/AutoBU/interface/ChainValidator.h"
+#include "EventFilter/AutoBU/interface/ThreadPlacement.h"
+#include "EventFilter/AutoBU/interface/WaitStrategy.h"
+#include "EventFilter/AutoBU/interface/FUTrace.h"
+#include "EventFilter/AutoBU/interface/PayloadGenerator.h"
+#include "EventFilter/AutoBU/interface/CrcPatch.h"
+#include "EventFilter/AutoBU/interface/EventClasses.h"
+#include "EventFilter/AutoBU/interface/GeneratorConfig.h"
+#include "EventFilter/AutoBU/interface/ShmTransport.h"
+#include "EventFilter/AutoBU/interface/FastCopy.h"
+#include "EventFilter/AutoBU/interface/MetricsSnapshot.h"
+#include "EventFilter/AutoBU/interface/StageCounters.h"
+#include "EventFilter/AutoBU/interface/MonitorHistory.h"
+#include "EventFilter/AutoBU/interface/LoadScan.h"
 
 #include "EventFilter/Utilities/interface/StateMachine.h"
 #include "EventFilter/Utilities/interface/WebGUI.h"
@@ -19,6 +35,7 @@
 
 #include "xdata/InfoSpace.h"
 #include "xdata/UnsignedInteger32.h"
+#include "xdata/Integer32.h"
 #include "xdata/Double.h"
 #include "xdata/Boolean.h"
 #include "xdata/String.h"
@@ -34,10 +51,12 @@
 #include "i2o/utils/AddressMap.h"
 
 #include "CLHEP/Random/RandGauss.h"
+#include "CLHEP/Random/RandFlat.h"
 
 
 #include <vector>
 #include <queue>
+#include <map>
 #include <cmath>
 #include <semaphore.h>
 #include <sys/time.h>
@@ -98,6 +117,40 @@ namespace evf {
     void startSendingWorkLoop() throw (evf::Exception);
     bool sending(toolbox::task::WorkLoop* wl);
 
+    // read playback events ahead of the builder
+    void startReadingWorkLoop() throw (evf::Exception);
+    bool reading(toolbox::task::WorkLoop* wl);
+
+    // write sampled events to disk
+    void startSamplingWorkLoop() throw (evf::Exception);
+    bool sampling(toolbox::task::WorkLoop* wl);
+    void stopSampling();
+
+    // emulate the FU: consume chains locally, discard and re-allocate
+    void startLoopbackWorkLoop() throw (evf::Exception);
+    bool loopback(toolbox::task::WorkLoop* wl);
+    void stopLoopback();
+
+    // take BU_ALLOCATE / BU_DISCARD frames from a same-host FU through shm
+    void startShmWorkLoop() throw (evf::Exception);
+    bool shmPolling(toolbox::task::WorkLoop* wl);
+    void stopShm();
+
+    // drive requests and discards from a recorded FU trace
+    void startReplayingWorkLoop() throw (evf::Exception);
+    bool replaying(toolbox::task::WorkLoop* wl);
+    void stopReplaying();
+
+    // validate sampled copies of the outgoing i2o chains
+    void startValidatingWorkLoop() throw (evf::Exception);
+    bool validating(toolbox::task::WorkLoop* wl);
+    void stopValidating();
+
+    // help serializing the super fragments of large events
+    void startSerializingWorkLoops() throw (evf::Exception);
+    bool serializing(toolbox::task::WorkLoop* wl);
+    void stopSerializing();
+
     // calculate monitoring information in separate thread
     void startMonitoringWorkLoop() throw (evf::Exception);
     bool monitoring(toolbox::task::WorkLoop* wl);
@@ -109,20 +162,64 @@ namespace evf {
     //
     void   lock()      { sem_wait(&lock_); }
     void   unlock()    { sem_post(&lock_); }
-    void   waitBuild() { sem_wait(&buildSem_); }
+    void   waitBuild() { buildWait_.wait(&buildSem_); }
     void   postBuild() { sem_post(&buildSem_); }
-    void   waitSend()  { sem_wait(&sendSem_); }
+    void   waitSend()  { sendWait_.wait(&sendSem_); }
+    bool   waitSend(const struct timespec* deadline)
+    {
+      return sendWait_.timedWait(&sendSem_,deadline);
+    }
     void   postSend()  { sem_post(&sendSem_); }
-    void   waitRqst()  { sem_wait(&rqstSem_); }
+    void   waitRqst()  { rqstWait_.wait(&rqstSem_); }
+    bool   tryRqst()   { return rqstWait_.tryWait(&rqstSem_); }
     void   postRqst()  { sem_post(&rqstSem_); }
     
+    void   placeThread(const char* name,int index=-1);
+    void   reclaimSlots();
+    bool   releaseSlot(unsigned int buResourceId);
+    void   adaptDepth(double deltaT);
+    void   publishMetrics();
+    bool   publishGeneratorConfig(std::string& error);
+    void   useGeneratorConfig(const evf::GeneratorConfig::Settings& gen);
+    void   paceBuilding();
+    void   startScan();
+    void   applyScanStep();
+    void   allocate(unsigned int fuResourceId);
+    bool   discard(unsigned int buResourceId);
+    void   allocateFrame(const I2O_BU_ALLOCATE_MESSAGE_FRAME* msg);
+    void   discardFrame(const I2O_BU_DISCARD_MESSAGE_FRAME* msg);
+    void   postShm(toolbox::mem::Reference* msg);
+    void   postChain(toolbox::mem::Reference* msg);
+    void   flushBatch();
+    void   recordSendLatency(const unsigned int* buResourceIds,unsigned int n);
+    void   discardOldest();
+    void   finishTrace();
     void   exportParameters();
     void   reset();
     double deltaT(const struct timeval *start,const struct timeval *end);
     
-    bool   generateEvent(evf::BUEvent* evt);
+    void   loadSuperFragTable() throw (evf::Exception);
+    void   initSuperFrags(const std::vector<double>& fedSizes);
+    bool   isPlaybackRunning();
+    FEDRawDataCollection *readPlaybackEvent(unsigned int& runNumber,
+					     unsigned int& evtNumber);
+    void   stopReadAhead();
+    void   waitReadAhead();
+    void   overwriteFed(unsigned char* fedAddr,unsigned int fedSize,
+			unsigned int offset,const void* data,unsigned int n);
+    bool   generateEvent(evf::BUEvent* evt,
+			 const evf::GeneratorConfig::Settings& gen);
     toolbox::mem::Reference *createMsgChain(evf::BUEvent *evt,
 					    unsigned int fuResourceId);
+    void   serializeSuperFrags();
+    void   createSuperFrag(evf::BUEvent *evt,
+			   unsigned int fuResourceId,
+			   unsigned int iSuperFrag,
+			   unsigned int nSuperFrag,
+			   unsigned int iFed,
+			   unsigned int nFed,
+			   toolbox::mem::Reference*& head,
+			   toolbox::mem::Reference*& tail);
     
     
     void dumpFrame(unsigned char* data,unsigned int len);
@@ -142,6 +239,10 @@ namespace evf {
     // FU application descriptor
     xdaq::ApplicationDescriptor    *fuAppDesc_;
     
+    // i2o addresses of BU and FU, as put into each block
+    I2O_TID                         buTid_;
+    I2O_TID                         fuTid_;
+    
     // BU application context
     xdaq::ApplicationContext       *buAppContext_;
     
@@ -152,14 +253,49 @@ namespace evf {
     WebGUI                         *gui_;
     
     // resource management
+    evf::ChunkPool                  eventPool_;
     std::vector<evf::BUEvent*>      events_;
     std::queue<unsigned int>        rqstIds_;
     std::queue<unsigned int>        freeIds_;
     std::queue<unsigned int>        builtIds_;
     std::set<unsigned int>          sentIds_;
+    std::vector<struct timeval>     sentTimes_;
+    std::vector<struct timeval>     builtTimes_;
+    // chains serialized by the builder, waiting for a request to be posted
+    std::vector<toolbox::mem::Reference*> chains_;
+    // slots not discarded in time, given back to freeIds_ after another
+    // timeout unless the late discard arrives first
+    std::map<unsigned int,struct timeval> reclaimedIds_;
     unsigned int                    evtNumber_;
     std::vector<unsigned int>       validFedIds_;
 
+    // assignment of feds to super fragments
+    enum SuperFragMode { SF_INDEX, SF_TABLE, SF_BALANCED };
+    SuperFragMode                   sfMode_;
+    std::map<unsigned int,unsigned int> sfTable_;
+    std::vector<std::vector<unsigned int> > superFragFeds_;
+    std::vector<double>             sfCalibSizes_;
+    unsigned int                    sfCalibN_;
+
+    // compressed events replayed once the cache is full
+    evf::ReplayCache                replayCache_;
+    bool                            replayCacheFull_;
+    unsigned int                    replayNext_;
+
+    // content of the fed bodies in RANDOM mode
+    evf::PayloadGenerator           payload_;
+
+    // RANDOM mode parameters, swapped in between events by the builder;
+    // the events built per class of the mix in use
+    evf::GeneratorConfig            genConfig_;
+    unsigned int                    genVersion_;
+    std::vector<std::string>        evtClassNames_;
+    std::vector<uint64_t>           evtClassCounts_;
+    int                             evtClass_;  // of the last event, -1: none
+
+    // trailer crc updates for the rewritten evt / ls / orbit numbers
+    evf::CrcPatch                   crcPatch_;
+
     bool                            isBuilding_;
     bool                            isSending_;
     bool                            isHalting_;
@@ -176,6 +312,88 @@ namespace evf {
     toolbox::task::WorkLoop        *wlMonitoring_;      
     toolbox::task::ActionSignature *asMonitoring_;
     
+    // workloop / action signature for reading playback events ahead
+    toolbox::task::WorkLoop        *wlReading_;      
+    toolbox::task::ActionSignature *asReading_;
+    bool                            isReading_;
+    bool                            isReadAhead_;
+    bool                            isReadDraining_;
+    struct ReadEvent
+    {
+      FEDRawDataCollection *event;
+      unsigned int          runNumber;
+      unsigned int          evtNumber;
+    };
+    std::queue<ReadEvent>           readEvents_;
+    
+    // workloop / action signature for writing sampled events
+    toolbox::task::WorkLoop        *wlSampling_;      
+    toolbox::task::ActionSignature *asSampling_;
+    bool                            isSampling_;
+    evf::EventSampler               sampler_;
+    
+    // workloop / action signature for the loopback FU emulation
+    toolbox::task::WorkLoop        *wlLoopback_;      
+    toolbox::task::ActionSignature *asLoopback_;
+    bool                            isLoopback_;
+    struct LoopbackChain
+    {
+      toolbox::mem::Reference *msg;
+      struct timeval           due;
+    };
+    std::queue<LoopbackChain>       loopbackChains_;
+    
+    // workloop / action signature for the shared memory transport
+    toolbox::task::WorkLoop        *wlShm_;      
+    toolbox::task::ActionSignature *asShm_;
+    bool                            isShmPolling_;
+    bool                            isShmStopping_;
+    bool                            isShm_;
+    evf::ShmTransport               shm_;
+    std::vector<unsigned char>      shmFrame_;
+    
+    // workloop / action signature for replaying FU traces
+    enum FUTraceMode { TRACE_NONE, TRACE_RECORD, TRACE_REPLAY };
+    FUTraceMode                     traceMode_;
+    evf::FUTrace                    fuTrace_;
+    toolbox::task::WorkLoop        *wlReplaying_;      
+    toolbox::task::ActionSignature *asReplaying_;
+    bool                            isReplaying_;
+    bool                            isTraceDone_;
+    struct timeval                  traceStart_;
+    std::queue<std::pair<unsigned int,unsigned int> > traceSentIds_;
+    unsigned int                    tracePendingDiscards_;
+    
+    // workloop / action signature for validating i2o chains
+    toolbox::task::WorkLoop        *wlValidating_;      
+    toolbox::task::ActionSignature *asValidating_;
+    bool                            isValidating_;
+    unsigned int                    validateEvery_; // prescale latched at start
+    evf::ChainValidator             validator_;
+    
+    // workloops / action signatures for serializing super fragments
+    std::vector<toolbox::task::WorkLoop*>        wlSerializing_;
+    std::vector<toolbox::task::ActionSignature*> asSerializing_;
+    unsigned int                    nbSerializersActive_;
+    unsigned int                    nbSerializersRunning_;
+    unsigned int                    nbSerializersIndexed_;
+    volatile bool                   isSerializeStopping_;
+    
+    // super fragments of the event currently being serialized
+    evf::BUEvent                   *serEvt_;
+    unsigned int                    serFuResourceId_;
+    unsigned int                    serNSuperFrag_;
+    unsigned int                    serNextSuperFrag_;
+    std::vector<unsigned int>       sfFirstFed_;
+    std::vector<toolbox::mem::Reference*> sfHead_;
+    std::vector<toolbox::mem::Reference*> sfTail_;
+    
+    
+    // cpu / priority of the workloop threads, applied by each thread
+    // itself when the version changes
+    evf::ThreadPlacement            placement_;
+    volatile unsigned int           placementVersion_;
+    std::map<std::string,std::string> placedThreads_;
     
     std::string                     sourceId_;
         
@@ -186,6 +404,16 @@ namespace evf {
     xdata::String                   hostname_;
     xdata::UnsignedInteger32        runNumber_;
     xdata::Double                   memUsedInMB_;
+    xdata::Double                   eventMemInMB_;
+    xdata::Double                   eventMemPeakInMB_;
+    xdata::Double                   replayCacheInMB_;
+    xdata::String                   lastChainError_;
+    xdata::String                   placementInfo_;
+    xdata::String                   eventClassInfo_;
+    xdata::UnsignedInteger32        activeDepth_;
+    xdata::String                   depthChangeReason_;
+    xdata::String                   stageCosts_[evf::StageCounters::N_STAGES];
+    xdata::String                   scanStatus_;
 
     xdata::Double                   deltaT_;
     xdata::UnsignedInteger32        deltaN_;
@@ -196,6 +424,9 @@ namespace evf {
     xdata::Double                   average_;
     xdata::Double                   rate_;
     xdata::Double                   rms_;
+    xdata::Double                   sendLatencyAvgUs_;
+    xdata::Double                   sendLatencyPeakUs_;
+    xdata::Double                   eventsPerPost_;
     
     // monitored counters
     xdata::UnsignedInteger32        nbEventsInBU_;
@@ -203,29 +434,137 @@ namespace evf {
     xdata::UnsignedInteger32        nbEventsBuilt_;
     xdata::UnsignedInteger32        nbEventsSent_;
     xdata::UnsignedInteger32        nbEventsDiscarded_;
+    xdata::UnsignedInteger32        nbEventsSampled_;
+    xdata::UnsignedInteger32        nbEventsSampleDropped_;
+    xdata::UnsignedInteger32        nbEventsDropped_;
+    xdata::UnsignedInteger32        nbChainsValidated_;
+    xdata::UnsignedInteger32        nbChainErrors_;
+    xdata::UnsignedInteger32        nbWaitImmediate_;
+    xdata::UnsignedInteger32        nbWaitSpins_;
+    xdata::UnsignedInteger32        nbWaitYields_;
+    xdata::UnsignedInteger32        nbWaitSleeps_;
+    xdata::UnsignedInteger32        nbSlotsReclaimed_;
+    xdata::UnsignedInteger32        nbLateDiscards_;
+    xdata::UnsignedInteger32        nbDuplicateDiscards_;
+    xdata::UnsignedInteger32        nbTraceRecords_;
+    xdata::UnsignedInteger32        nbShmFullWaits_;
     
     // standard parameters
     xdata::String                   mode_;
     xdata::Boolean                  replay_;
+    xdata::UnsignedInteger32        replayCacheSize_;
     xdata::Boolean                  crc_;
     xdata::Boolean                  overwriteEvtId_;
     xdata::Boolean                  overwriteLsId_;
     xdata::UnsignedInteger32        fakeLsUpdateSecs_;
+    xdata::Boolean                  patchCrc_;
     xdata::UnsignedInteger32        firstEvent_;
     xdata::UnsignedInteger32        queueSize_;
     xdata::UnsignedInteger32        eventBufferSize_;
+    xdata::UnsignedInteger32        eventChunkSize_;
+    xdata::UnsignedInteger32        eventMemoryMaxInMB_;
     xdata::UnsignedInteger32        msgBufferSize_;
     xdata::UnsignedInteger32        fedSizeMax_;
     xdata::UnsignedInteger32        fedSizeMean_;
     xdata::UnsignedInteger32        fedSizeWidth_;
     xdata::Boolean                  useFixedFedSize_;
+    xdata::String                   payloadPattern_;
+    xdata::Double                   payloadOccupancy_;
+    xdata::String                   eventClasses_;
     xdata::UnsignedInteger32        monSleepSec_;
+    xdata::String                   superFragMode_;
+    xdata::String                   superFragTable_;
+    xdata::UnsignedInteger32        nbSuperFrags_;
+    xdata::UnsignedInteger32        superFragCalibEvents_;
+    xdata::UnsignedInteger32        readAheadDepth_;
+    xdata::UnsignedInteger32        samplePrescale_;
+    xdata::UnsignedInteger32        sampleMinSize_;
+    xdata::UnsignedInteger32        sampleBufferSize_;
+    xdata::String                   sampleDir_;
+    xdata::UnsignedInteger32        validatePrescale_;
+    xdata::Boolean                  validateCrc_;
+    xdata::String                   threadPlacement_;
+    xdata::Integer32                numaNode_;
+    xdata::String                   waitStrategy_;
+    xdata::UnsignedInteger32        spinCount_;
+    xdata::UnsignedInteger32        yieldCount_;
+    xdata::UnsignedInteger32        discardTimeoutSec_;
+    xdata::Boolean                  adaptiveDepth_;
+    xdata::UnsignedInteger32        depthMin_;
+    xdata::Double                   depthMargin_;
+    xdata::UnsignedInteger32        perfPrescale_;
+    xdata::UnsignedInteger32        historySize_;
+    xdata::Double                   targetRate_;
+    xdata::String                   scanSchedule_;
+    xdata::UnsignedInteger32        scanMinStepSec_;
+    xdata::UnsignedInteger32        scanMaxStepSec_;
+    xdata::UnsignedInteger32        scanSteadyIntervals_;
+    xdata::Double                   scanTolerance_;
+    xdata::Boolean                  loopback_;
+    xdata::UnsignedInteger32        loopbackDelayUs_;
+    xdata::UnsignedInteger32        loopbackCredits_;
+    xdata::String                   shmName_;
+    xdata::UnsignedInteger32        shmSizeMB_;
+    xdata::UnsignedInteger32        shmPollUs_;
+    xdata::String                   fuTraceMode_;
+    xdata::String                   fuTraceFile_;
+    xdata::UnsignedInteger32        sendBatchSize_;
+    xdata::UnsignedInteger32        sendBatchBytes_;
+    xdata::UnsignedInteger32        sendBatchDelayUs_;
+    xdata::UnsignedInteger32        nbSerializers_;
+    xdata::UnsignedInteger32        parallelSerializeMinSize_;
+    xdata::Boolean                  preSerialize_;
+    xdata::UnsignedInteger32        ntCopyThreshold_;
+    bool                            isPreSerializing_;
 
     unsigned int                    fakeLs_;
     timeval                         lastLsUpdate_;
-    // gaussian aprameters for randpm fed size generation (log-normal)
-    double                          gaussianMean_;
-    double                          gaussianWidth_;
+    
+    // chains of several events posted together, see postChain()
+    toolbox::mem::Reference        *batchHead_;
+    toolbox::mem::Reference        *batchTail_;
+    uint64_t                        batchBytes_;
+    std::vector<unsigned int>       batchIds_;
+    struct timespec                 batchDeadline_;
+    
+    // time from built to posted, summed up between monitoring updates
+    double                          sendLatencySumUs_;
+    double                          sendLatencyMaxUs_;
+    unsigned int                    sendLatencyN_;
+    unsigned int                    nbPosts_;
+    
+    // served by customWebPage()
+    evf::MetricsSnapshot            metrics_;
+    evf::LatencyHistogram           sendLatencyHist_;
+    evf::LatencyHistogram           discardLatencyHist_;
+    
+    // hardware counters / cpu time of generateEvent, createMsgChain and
+    // the i2o callbacks
+    evf::StageCounters              stageCounters_;
+    
+    // past monitoring intervals, and the fed size / rate scan driven by them
+    evf::MonitorHistory             history_;
+    evf::LoadScan                   scan_;
+    unsigned int                    scanFedSizeMean_;
+    unsigned int                    scanFedSizeWidth_;
+    double                          scanRate_;
+    uint64_t                        histLastCount_;
+    uint64_t                        histLastSumUs_;
+    
+    // builder pacing, events per second (0: as fast as possible), as of
+    // the generator settings of the previous event
+    double                          buildRate_;
+    double                          nextBuildTime_;
+    
+    // adaptive in-flight depth: slots given back beyond activeDepth_ are
+    // parked, see adaptDepth()
+    unsigned int                    nbActiveSlots_;
+    std::vector<unsigned int>       parkedIds_;
+    double                          discardLatencySum_;
+    unsigned int                    discardLatencyN_;
+    unsigned int                    depthLastRqst_;
+    double                          rqstRateAvg_;
+    double                          discardLatencyAvg_;
     
     // monitoring helpers
     struct timeval                  monStartTime_;
@@ -244,6 +583,16 @@ namespace evf {
     sem_t                           buildSem_;
     sem_t                           sendSem_;
     sem_t                           rqstSem_;
+    sem_t                           readSlotSem_;
+    sem_t                           readReadySem_;
+    sem_t                           serializeSem_;
+    sem_t                           serializeDoneSem_;
+    sem_t                           serializeMutex_;
+    sem_t                           loopbackSem_;
+    sem_t                           traceStopSem_;
+    evf::WaitStrategy               buildWait_;
+    evf::WaitStrategy               sendWait_;
+    evf::WaitStrategy               rqstWait_;
 
   
     //
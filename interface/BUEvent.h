@@ -2,6 +2,11 @@
 #define BUEVENT_H 1
 
 
+#include "EventFilter/AutoBU/interface/ChunkPool.h"
+
+#include <vector>
+
+
 namespace evf
 {
 
@@ -11,7 +16,7 @@ namespace evf
     //
     // construction/destruction
     //
-    BUEvent(unsigned int buResourceId,unsigned int bufferSize=0x400000);
+    BUEvent(unsigned int buResourceId,ChunkPool* pool);
     virtual ~BUEvent();
     
 
@@ -23,35 +28,54 @@ namespace evf
     bool           writeFed(unsigned int id,unsigned char* data,unsigned int size);
     bool           writeFedHeader(unsigned int i);
     bool           writeFedTrailer(unsigned int i);
+    void           startSuperFrag();
+    void           setEvtType(unsigned int evtType) { evtType_=evtType; }
     
     unsigned int   buResourceId()          const { return buResourceId_; }
     unsigned int   evtNumber()             const { return evtNumber_; }
+    unsigned int   evtType()               const { return evtType_; }
     unsigned int   evtSize()               const { return evtSize_; }
-    unsigned int   bufferSize()            const { return bufferSize_; }
+    unsigned int   memSize()               const { return memSize_; }
     unsigned int   nFed()                  const { return nFed_; }
     unsigned int   fedId(unsigned int i)   const { return fedId_[i]; }
     unsigned int   fedSize(unsigned int i) const { return fedSize_[i]; }
-    unsigned char* fedAddr(unsigned int i) const;
+    unsigned char* fedAddr(unsigned int i) const { return fedAddr_[i]; }
+    unsigned int   nSuperFrag()            const;
+    unsigned int   superFragFirstFed(unsigned int i) const { return sfFirstFed_[i]; }
+    bool           isTruncated()           const { return truncated_; }
     
     static bool    computeCrc() { return computeCrc_; }
     static void    setComputeCrc(bool computeCrc) { computeCrc_=computeCrc; }
-
-    void           dump();
     
     
   private:
+    //
+    // private member functions
+    //
+    bool           newChunk(unsigned int size);
+    
+    
     //
     // member data
     //
     unsigned int   buResourceId_;
     unsigned int   evtNumber_;
+    unsigned int   evtType_;
     unsigned int   evtSize_;
-    unsigned int   bufferSize_;
+    unsigned int   memSize_;
     unsigned int   nFed_;
     unsigned int  *fedId_;
-    unsigned int  *fedPos_;
+    unsigned char**fedAddr_;
     unsigned int  *fedSize_;
-    unsigned char *buffer_;
+    unsigned int   nSuperFrag_;
+    unsigned int  *sfFirstFed_;
+    bool           truncated_;    // a writeFed() failed since initialize()
+    
+    ChunkPool                  *pool_;
+    std::vector<unsigned char*> chunks_;
+    std::vector<unsigned int>   chunkSizes_;
+    unsigned char              *chunkPos_;
+    unsigned int                chunkLeft_;
 
     static bool    computeCrc_;
     
@@ -0,0 +1,105 @@
+#ifndef CHAINVALIDATOR_H
+#define CHAINVALIDATOR_H 1
+
+
+#include "toolbox/mem/Reference.h"
+
+#include <string>
+#include <sstream>
+#include <vector>
+#include <stdint.h>
+#include <semaphore.h>
+
+
+namespace evf
+{
+
+  class BUEvent;
+
+  //
+  // checks copies of outgoing I2O_FU_TAKE chains in a separate thread:
+  // message sizes and function codes, block / super fragment numbering,
+  // FRL segment sizes and last segment flags, and the fed header / trailer
+  // markers and lengths of all feds (optionally their CRC), walking back
+  // from the end of each super fragment
+  //
+  class ChainValidator
+  {
+  public:
+    //
+    // construction/destruction
+    //
+    ChainValidator();
+    virtual ~ChainValidator();
+
+
+    //
+    // member functions
+    //
+
+    // called before the validating thread is started
+    void           start(bool checkCrc);
+
+    // sender side: copy the chain, false if the previous one is still checked
+    bool           submit(toolbox::mem::Reference* head,
+			  const BUEvent* evt,
+			  unsigned int fuResourceId);
+
+    // validating thread: wait for a chain and check it, false once stopped
+    bool           validate();
+
+    // let the validating thread return
+    void           stop();
+
+    uint64_t       nbValidated()           const { return nbValidated_; }
+    uint64_t       nbErrors()              const { return nbErrors_; }
+    uint64_t       nbSkipped()             const { return nbSkipped_; }
+    std::string    lastError();
+
+
+  private:
+    //
+    // private member functions
+    //
+    void           lock()   { sem_wait(&lock_); }
+    void           unlock() { sem_post(&lock_); }
+    bool           checkChain(std::ostringstream& err);
+    bool           checkSuperFrag(unsigned int iSuperFrag,
+				  std::ostringstream& err);
+
+
+    //
+    // member data
+    //
+    std::vector<unsigned char> frames_;
+    std::vector<unsigned int>  frameSizes_;
+    std::vector<unsigned char> superFrag_;
+
+    // expected values, from the event at the time of the copy
+    unsigned int             buResourceId_;
+    unsigned int             fuResourceId_;
+    unsigned int             evtNumber_;
+    unsigned int             nFed_;
+    unsigned int             evtSize_;
+
+    // found while walking the chain
+    unsigned int             nFedFound_;
+    unsigned int             evtSizeFound_;
+
+    bool                     checkCrc_;
+    volatile bool            busy_;
+    volatile bool            stopping_;
+    uint64_t                 nbValidated_;
+    uint64_t                 nbErrors_;
+    uint64_t                 nbSkipped_;
+    std::string              lastError_;
+    sem_t                    readySem_;
+    sem_t                    lock_;
+
+  };
+
+
+} // namespace evf
+
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef CHUNKPOOL_H
+#define CHUNKPOOL_H 1
+
+
+#include <vector>
+#include <stdint.h>
+#include <semaphore.h>
+
+
+namespace evf
+{
+
+  //
+  // memory for the fed data of all BUEvents: chunks of chunkSize*2^n
+  // bytes, recycled through one free list per size class
+  //
+  class ChunkPool
+  {
+  public:
+    //
+    // construction/destruction
+    //
+    ChunkPool();
+    virtual ~ChunkPool();
+
+
+    //
+    // member functions
+    //
+
+    // only call while no chunk is in use, numaNode<0: default placement
+    void           configure(unsigned int chunkSize,uint64_t maxSize,
+			     int numaNode=-1);
+
+    // returns 0 if maxSize would be exceeded
+    unsigned char* allocate(unsigned int size,unsigned int& chunkSize);
+    void           release(unsigned char* chunk,unsigned int chunkSize);
+
+    unsigned int   chunkSize()             const { return chunkSize_; }
+    uint64_t       maxSize()               const { return maxSize_; }
+    uint64_t       used()                  const { return used_; }
+    uint64_t       peakUsed()              const { return peakUsed_; }
+    uint64_t       reserved()              const { return reserved_; }
+    int            numaNode()              const { return numaNode_; }
+    unsigned int   nbNumaFailures()        const { return nbNumaFailures_; }
+    void           resetPeak()                   { peakUsed_=used_; }
+
+
+  private:
+    //
+    // private member functions
+    //
+    void           lock()   { sem_wait(&lock_); }
+    void           unlock() { sem_post(&lock_); }
+    unsigned int   sizeClass(unsigned int size) const;
+    void           trim();
+
+
+    //
+    // member data
+    //
+    unsigned int                              chunkSize_;
+    uint64_t                                  maxSize_;
+    uint64_t                                  used_;
+    uint64_t                                  peakUsed_;
+    uint64_t                                  reserved_;
+    int                                       numaNode_;
+    unsigned int                              nbNumaFailures_;
+    std::vector<std::vector<unsigned char*> > free_;
+    sem_t                                     lock_;
+
+  };
+
+
+} // namespace evf
+
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef CRCPATCH_H
+#define CRCPATCH_H 1
+
+
+namespace evf
+{
+
+  //
+  // overwrites bytes of a fed and updates the crc in its trailer without
+  // recomputing it: the crc is linear, so the change of the crc only
+  // depends on the changed bits and on the number of 64 bit words behind
+  // them, which is applied as powers of the 'zero word' matrix. the tables
+  // are derived from evf::compute_crc() itself
+  //
+  class CrcPatch
+  {
+  public:
+    //
+    // construction/destruction
+    //
+    CrcPatch();
+    virtual ~CrcPatch();
+
+
+    //
+    // member functions
+    //
+
+    // copy n bytes to fedAddr+offset and patch the trailer crc; the data
+    // is written but the crc left alone (false) if the bytes are not
+    // in front of the trailer
+    bool           write(unsigned char* fedAddr,unsigned int fedSize,
+			 unsigned int offset,const void* data,
+			 unsigned int n) const;
+
+
+  private:
+    //
+    // private member functions
+    //
+
+    // crc contribution of the 64 bit word 'delta', nWords words before the end
+    unsigned short contribution(const unsigned char* delta,
+				unsigned int nWords) const;
+
+
+    //
+    // member data
+    //
+
+    // crc of a single word with one byte set, per byte position and value
+    unsigned short wordTable_[8][256];
+
+    // A^(2^p) applied to the low and high byte of a crc, A being the
+    // crc update by one zero word
+    unsigned short zeroWords_[32][2][256];
+
+  };
+
+
+} // namespace evf
+
+
+#endif
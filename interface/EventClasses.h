@@ -0,0 +1,79 @@
+#ifndef EVENTCLASSES_H
+#define EVENTCLASSES_H 1
+
+
+#include <string>
+#include <vector>
+
+
+namespace evf
+{
+
+  //
+  // weighted mix of event classes for RANDOM mode, configured as
+  //
+  //   "<name>:<weight>:<feds>:<mean>[:<width>[:<evtType>]];..."
+  //
+  // e.g. "physics:90:*:2048:1024:1;calib:9:600-700:256::2;empty:1:0:16"
+  // where <feds> is '*' or a list like "0-31,700" (restricting the feds of
+  // the event, an empty <width> or 0 means fixed size) and <evtType> the
+  // Evt_ty of the fed headers (default 1). classes are drawn in constant
+  // time with Walker's alias method
+  //
+  class EventClasses
+  {
+  public:
+    //
+    // construction/destruction
+    //
+    EventClasses();
+    virtual ~EventClasses();
+
+
+    //
+    // member functions
+    //
+    struct EventClass
+    {
+      std::string       name;
+      double            weight;
+      std::vector<bool> feds;
+      unsigned int      fedSizeMean;
+      unsigned int      fedSizeWidth;
+      double            gaussianMean;
+      double            gaussianWidth;
+      unsigned int      evtType;
+    };
+
+    // returns false and leaves the previous configuration on syntax errors
+    bool           configure(const std::string& spec,std::string& error);
+
+    // index of the class for the uniform random number u in [0,1)
+    unsigned int   sample(double u) const;
+
+    unsigned int   size()                  const { return classes_.size(); }
+    const EventClass& operator[](unsigned int i) const { return classes_[i]; }
+
+
+  private:
+    //
+    // private member functions
+    //
+    static bool    parseFedList(const std::string& fedList,
+				std::vector<bool>& feds);
+
+
+    //
+    // member data
+    //
+    std::vector<EventClass>   classes_;
+    std::vector<double>       prob_;
+    std::vector<unsigned int> alias_;
+
+  };
+
+
+} // namespace evf
+
+
+#endif
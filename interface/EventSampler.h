@@ -0,0 +1,109 @@
+#ifndef EVENTSAMPLER_H
+#define EVENTSAMPLER_H 1
+
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <semaphore.h>
+
+
+namespace evf
+{
+
+  class BUEvent;
+
+  //
+  // copies sampled events into a ring buffer, from which a separate thread
+  // streams them to a binary file:
+  //
+  //   file header : char magic[8]="AUTOBUSP", uint32 version, uint32 0
+  //   record      : uint32 recordSize, evtNumber, nFed, evtSize,
+  //                 nFed x { uint32 fedId, fedSize },
+  //                 fed data, each fed padded to 8 bytes
+  //   index       : nRecord x { uint32 evtNumber, recordSize, uint64 offset }
+  //   footer      : uint64 indexOffset, nRecord, char magic[8]="AUTOBUIX"
+  //
+  class EventSampler
+  {
+  public:
+    //
+    // construction/destruction
+    //
+    EventSampler();
+    virtual ~EventSampler();
+
+
+    //
+    // member functions
+    //
+
+    // called before the writer thread is started
+    bool           open(const std::string& fileName,
+			unsigned int bufferSize,
+			unsigned int prescale,
+			unsigned int minEvtSize);
+
+    // producer side: copy evt if sampled and if there is enough space
+    bool           sample(const BUEvent* evt);
+
+    // consumer side: wait for records and write them, false once closed
+    bool           write();
+
+    // let the writer flush the buffer, write the index and close the file
+    void           close();
+
+    bool           isOpen()                const { return fd_>=0; }
+    const std::string& fileName()          const { return fileName_; }
+    uint64_t       nbSampled()             const { return nbSampled_; }
+    uint64_t       nbDropped()             const { return nbDropped_; }
+    uint64_t       nbWritten()             const { return nbWritten_; }
+    uint64_t       bytesWritten()          const { return bytesWritten_; }
+
+    static const char*  fileMagic_;
+    static const char*  indexMagic_;
+    static const unsigned int version_=1;
+
+
+  private:
+    //
+    // private member functions
+    //
+    bool           writeSpan(uint64_t begin,uint64_t end);
+    void           finish();
+
+
+    //
+    // member data
+    //
+    struct IndexEntry
+    {
+      uint32_t evtNumber;
+      uint32_t recordSize;
+      uint64_t offset;
+    };
+
+    int                      fd_;
+    std::string              fileName_;
+    unsigned char           *buffer_;
+    uint64_t                 bufferSize_;
+    volatile uint64_t        head_;
+    volatile uint64_t        tail_;
+    volatile bool            closing_;
+    unsigned int             prescale_;
+    unsigned int             minEvtSize_;
+    uint64_t                 nbSeen_;
+    uint64_t                 nbSampled_;
+    uint64_t                 nbDropped_;
+    uint64_t                 nbWritten_;
+    uint64_t                 bytesWritten_;
+    std::vector<IndexEntry>  index_;
+    sem_t                    dataSem_;
+
+  };
+
+
+} // namespace evf
+
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef FUTRACE_H
+#define FUTRACE_H 1
+
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <stdint.h>
+#include <semaphore.h>
+#include <sys/time.h>
+
+
+namespace evf
+{
+
+  //
+  // binary trace of the BU_ALLOCATE / BU_DISCARD messages received from
+  // the FU, to replay the same demand pattern later:
+  //
+  //   header : char magic[8]="AUTOBUFT", uint32 version, uint32 0
+  //   record : uint64 time [us since open], uint32 type<<24 | n,
+  //            n x uint32 fuTransactionId (ALLOCATE) / buResourceId (DISCARD)
+  //
+  class FUTrace
+  {
+  public:
+    //
+    // construction/destruction
+    //
+    FUTrace();
+    virtual ~FUTrace();
+
+
+    //
+    // member functions
+    //
+    enum RecordType { ALLOCATE=1, DISCARD=2 };
+
+    struct Record
+    {
+      uint64_t                  timeUs;
+      RecordType                type;
+      std::vector<unsigned int> ids;
+    };
+
+    // recording, record() may be called from any thread
+    bool           openRecord(const std::string& fileName);
+    void           record(RecordType type,const unsigned int* ids,unsigned int n);
+
+    // replaying, the whole trace is read at once
+    bool           openReplay(const std::string& fileName);
+    bool           next(Record& record);
+
+    void           close();
+
+    bool           isRecording()           const { return 0!=file_; }
+    uint64_t       nbRecords()             const { return nbRecords_; }
+    const std::string& error()             const { return error_; }
+
+    static const char*  magic_;
+    static const unsigned int version_=1;
+
+
+  private:
+    //
+    // private member functions
+    //
+    void           lock()   { sem_wait(&lock_); }
+    void           unlock() { sem_post(&lock_); }
+
+
+    //
+    // member data
+    //
+    FILE                      *file_;
+    struct timeval             start_;
+    std::vector<unsigned char> replay_;
+    size_t                     replayPos_;
+    uint64_t                   nbRecords_;
+    std::string                error_;
+    sem_t                      lock_;
+
+  };
+
+
+} // namespace evf
+
+
+#endif
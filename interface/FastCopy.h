@@ -0,0 +1,53 @@
+#ifndef FASTCOPY_H
+#define FASTCOPY_H 1
+
+
+#include <cstring>
+#include <cstddef>
+
+
+namespace evf
+{
+
+  //
+  // copies of fed data into buffers which are not read again by the copying
+  // thread (event chunks, i2o frames): from threshold bytes on, with
+  // non-temporal stores which bypass the caches, using the widest kernel the
+  // cpu supports (AVX-512, AVX2, SSE2). smaller copies, and all copies with
+  // threshold 0 or on other architectures, use memcpy
+  //
+  class FastCopy
+  {
+  public:
+    //
+    // member functions
+    //
+
+    // not thread safe, call before the copying threads run
+    static void         configure(size_t threshold);
+
+    static void         copy(void* dst,const void* src,size_t n)
+    {
+      if (0==threshold_||n<threshold_) memcpy(dst,src,n);
+      else streamCopy_(dst,src,n);
+    }
+
+    static size_t       threshold()        { return threshold_; }
+    static const char*  kernelName()       { return kernelName_; }
+
+
+  private:
+    //
+    // member data
+    //
+    static void       (*streamCopy_)(void* dst,const void* src,size_t n);
+    static size_t       threshold_;
+    static const char*  kernelName_;
+
+  };
+
+
+} // namespace evf
+
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef GENERATORCONFIG_H
+#define GENERATORCONFIG_H 1
+
+
+#include "EventFilter/AutoBU/interface/EventClasses.h"
+
+#include <string>
+#include <semaphore.h>
+
+
+namespace evf
+{
+
+  //
+  // parameters of the RANDOM mode event generation, double buffered: the
+  // writer fills the spare copy and flips, the builder acquires the current
+  // copy for one event and releases it. the writer only waits if the builder
+  // is still generating an event from the spare copy, never the builder
+  //
+  class GeneratorConfig
+  {
+  public:
+    //
+    // construction/destruction
+    //
+    GeneratorConfig();
+    virtual ~GeneratorConfig();
+
+
+    //
+    // member functions
+    //
+    struct Settings
+    {
+      unsigned int      fedSizeMean;
+      unsigned int      fedSizeWidth;
+      unsigned int      fedSizeMax;
+      bool              fixedFedSize;
+      bool              crc;
+      double            targetRate;      // events per second, 0: unthrottled
+      double            gaussianMean;    // log-normal fed sizes, see complete()
+      double            gaussianWidth;
+      evf::EventClasses eventClasses;
+      unsigned int      version;         // set by publish()
+    };
+
+    // checks the fed sizes and computes the log-normal parameters
+    static bool    complete(Settings& settings,std::string& error);
+
+    // writer side, returns the version of the published settings
+    unsigned int   publish(const Settings& settings);
+    void           current(Settings& settings);
+    unsigned int   version() const { return version_; }
+
+    // builder side, a single thread
+    const Settings& acquire();
+    void           release();
+
+
+  private:
+    //
+    // private member functions
+    //
+    void           lock()   { sem_wait(&lock_); }
+    void           unlock() { sem_post(&lock_); }
+
+
+    //
+    // member data
+    //
+    Settings          slots_[2];
+    volatile int      current_;
+    volatile int      readSlot_;    // slot used by the builder, -1 if none
+    volatile unsigned int version_;
+    sem_t             lock_;
+
+  };
+
+
+} // namespace evf
+
+
+#endif
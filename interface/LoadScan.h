@@ -0,0 +1,113 @@
+#ifndef LOADSCAN_H
+#define LOADSCAN_H 1
+
+
+#include "EventFilter/AutoBU/interface/MonitorHistory.h"
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <semaphore.h>
+
+
+namespace evf
+{
+
+  //
+  // steps the fed size and / or the target rate through a schedule
+  //
+  //   "<fedSize>[@<rateHz>];..."   e.g. "1024;2048;4096;2048@5000"
+  //
+  // (0 or no value keeps the configured one), waits at each step for
+  // 'steadyIntervals' monitoring intervals whose rates agree within
+  // 'tolerance' (at least minStepSec, at most maxStepSec) and records their
+  // averages in a rate vs size table
+  //
+  class LoadScan
+  {
+  public:
+    //
+    // construction/destruction
+    //
+    LoadScan();
+    virtual ~LoadScan();
+
+
+    //
+    // member functions
+    //
+    struct Step
+    {
+      unsigned int fedSize;
+      double       rate;
+    };
+
+    struct Result
+    {
+      Step         step;
+      double       rate;
+      double       throughput;
+      double       average;
+      double       sendLatencyUs;
+      double       discardLatencyUs;
+      double       seconds;
+      bool         steady;
+    };
+
+    // returns false and leaves the previous configuration on syntax errors
+    bool           configure(const std::string& schedule,
+			     unsigned int minStepSec,unsigned int maxStepSec,
+			     unsigned int steadyIntervals,double tolerance,
+			     std::string& error);
+
+    bool           isConfigured()          const { return !steps_.empty(); }
+    bool           isActive()              const { return active_; }
+    const Step&    step()                  const { return steps_[iStep_]; }
+    unsigned int   iStep()                 const { return iStep_; }
+    unsigned int   nSteps()                const { return steps_.size(); }
+
+    // clears the results and goes to the first step
+    void           start();
+    void           stop()                        { active_=false; }
+
+    // one monitoring interval, true if the step changed or the scan ended
+    bool           update(const MonitorHistory::Entry& entry);
+
+    void           results(std::vector<Result>& results);
+
+    static void    writeTable(std::ostream& out,
+			      const std::vector<Result>& results);
+
+
+  private:
+    //
+    // private member functions
+    //
+    void           lock()   { sem_wait(&lock_); }
+    void           unlock() { sem_post(&lock_); }
+    bool           isSteady() const;
+
+
+    //
+    // member data
+    //
+    std::vector<Step>                  steps_;
+    unsigned int                       minStepSec_;
+    unsigned int                       maxStepSec_;
+    unsigned int                       steadyIntervals_;
+    double                             tolerance_;
+
+    bool                               active_;
+    unsigned int                       iStep_;
+    double                             stepSeconds_;
+    std::vector<MonitorHistory::Entry> intervals_;
+    std::vector<Result>                results_;
+    sem_t                              lock_;
+
+  };
+
+
+} // namespace evf
+
+
+#endif
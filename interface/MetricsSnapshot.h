@@ -0,0 +1,114 @@
+#ifndef METRICSSNAPSHOT_H
+#define METRICSSNAPSHOT_H 1
+
+
+#include <string>
+#include <ostream>
+#include <stdint.h>
+
+
+namespace evf
+{
+
+  //
+  // log2 histogram of latencies in microseconds, filled without locks:
+  // bin i counts [2^(i-1),2^i) us, bin 0 below 1us, the last one overflows
+  //
+  class LatencyHistogram
+  {
+  public:
+    //
+    // construction/destruction
+    //
+    LatencyHistogram();
+    virtual ~LatencyHistogram();
+
+
+    //
+    // member functions
+    //
+    enum { nBins=24 };
+
+    void           add(double us);
+    void           read(uint64_t* bins,uint64_t& sumUs) const;
+    void           reset();
+
+    // upper edge of bin i in us, 0 for the overflow bin
+    static double  upperEdge(unsigned int i);
+
+
+  private:
+    //
+    // member data
+    //
+    volatile uint64_t bins_[nBins];
+    volatile uint64_t sumUs_;
+
+  };
+
+
+  //
+  // counters, rates, queue depths, memory and latency histograms of the BU,
+  // published by the monitoring thread and served by BU::customWebPage()
+  // as JSON or OpenMetrics text. a seqlock: the writer never waits, readers
+  // copy and retry if the writer was active meanwhile
+  //
+  class MetricsSnapshot
+  {
+  public:
+    //
+    // construction/destruction
+    //
+    MetricsSnapshot();
+    virtual ~MetricsSnapshot();
+
+
+    //
+    // member functions
+    //
+    enum Metric {
+      NB_EVTS_IN_BU, NB_EVTS_REQUESTED, NB_EVTS_BUILT, NB_EVTS_SENT,
+      NB_EVTS_DISCARDED, NB_SLOTS_RECLAIMED, NB_LATE_DISCARDS,
+      NB_CHAIN_ERRORS, RATE, THROUGHPUT, AVERAGE, RMS,
+      FREE_SLOTS, BUILT_SLOTS, SENT_SLOTS, PENDING_REQUESTS, PARKED_SLOTS,
+      ACTIVE_DEPTH, EVENT_MEM, EVENT_MEM_PEAK, REPLAY_CACHE_MEM,
+      SEND_LATENCY_AVG, SEND_LATENCY_PEAK, EVENTS_PER_POST,
+      N_METRICS
+    };
+
+    struct Data
+    {
+      double   timestamp;
+      double   values[N_METRICS];
+      uint64_t sendLatency[LatencyHistogram::nBins];
+      uint64_t sendLatencySumUs;
+      uint64_t discardLatency[LatencyHistogram::nBins];
+      uint64_t discardLatencySumUs;
+    };
+
+    // single writer
+    void           publish(const Data& data);
+
+    // false if no consistent copy was published (yet)
+    bool           read(Data& data) const;
+
+    static void    writeJson(std::ostream& out,const Data& data,
+			     const std::string& source);
+    static void    writeOpenMetrics(std::ostream& out,const Data& data,
+				    const std::string& source);
+
+
+  private:
+    //
+    // member data
+    //
+    volatile uint32_t seq_;
+    Data              data_;
+
+  };
+
+
+} // namespace evf
+
+
+#endif
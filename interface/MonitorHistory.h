@@ -0,0 +1,75 @@
+#ifndef MONITORHISTORY_H
+#define MONITORHISTORY_H 1
+
+
+#include <vector>
+#include <ostream>
+#include <semaphore.h>
+
+
+namespace evf
+{
+
+  //
+  // ring of the values of the last 'capacity' monitoring intervals
+  //
+  class MonitorHistory
+  {
+  public:
+    //
+    // construction/destruction
+    //
+    MonitorHistory();
+    virtual ~MonitorHistory();
+
+
+    //
+    // member functions
+    //
+    struct Entry
+    {
+      double       time;
+      double       deltaT;
+      double       rate;
+      double       throughput;
+      double       average;
+      double       rms;
+      double       sendLatencyUs;
+      double       discardLatencyUs;
+      unsigned int fedSizeMean;
+      unsigned int activeDepth;
+    };
+
+    // clears the history
+    void           configure(unsigned int capacity);
+    void           add(const Entry& entry);
+
+    // oldest first
+    void           entries(std::vector<Entry>& entries);
+
+    static void    writeJson(std::ostream& out,const std::vector<Entry>& entries);
+
+
+  private:
+    //
+    // private member functions
+    //
+    void           lock()   { sem_wait(&lock_); }
+    void           unlock() { sem_post(&lock_); }
+
+
+    //
+    // member data
+    //
+    std::vector<Entry> ring_;
+    unsigned int       next_;
+    unsigned int       size_;
+    sem_t              lock_;
+
+  };
+
+
+} // namespace evf
+
+
+#endif
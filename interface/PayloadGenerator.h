@@ -0,0 +1,63 @@
+#ifndef PAYLOADGENERATOR_H
+#define PAYLOADGENERATOR_H 1
+
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+
+namespace evf
+{
+
+  //
+  // fills the fed bodies of generated events:
+  //   NONE   : leave the memory as it is
+  //   ZEROS  : all zeros
+  //   RANDOM : incompressible random bytes
+  //   ZS     : 16 bit channel readout, a fraction 'occupancy' of the
+  //            channels hit with small adc values, all others zero
+  //
+  class PayloadGenerator
+  {
+  public:
+    //
+    // construction/destruction
+    //
+    PayloadGenerator();
+    virtual ~PayloadGenerator();
+
+
+    //
+    // member functions
+    //
+    enum Pattern { NONE, ZEROS, RANDOM, ZS };
+
+    bool           configure(const std::string& pattern,double occupancy);
+    void           fill(unsigned char* data,unsigned int size);
+
+    Pattern        pattern()               const { return pattern_; }
+
+
+  private:
+    //
+    // private member functions
+    //
+    void           fillRandom(unsigned char* data,unsigned int size);
+    void           fillZS(unsigned char* data,unsigned int size);
+
+
+    //
+    // member data
+    //
+    Pattern        pattern_;
+    uint64_t       state_[4];
+    std::vector<unsigned short> channels_;
+
+  };
+
+
+} // namespace evf
+
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef REPLAYCACHE_H
+#define REPLAYCACHE_H 1
+
+
+#include <vector>
+#include <stdint.h>
+
+
+namespace evf
+{
+
+  class BUEvent;
+
+  class ReplayCache
+  {
+  public:
+    //
+    // construction/destruction
+    //
+    ReplayCache();
+    virtual ~ReplayCache();
+
+
+    //
+    // member functions
+    //
+    void           clear();
+
+    // compress the feds of evt and append it to the cache
+    bool           add(const BUEvent* evt);
+
+    // decompress the i-th cached event into evt
+    bool           fill(unsigned int i,BUEvent* evt) const;
+
+    unsigned int   size()                  const { return events_.size(); }
+    uint64_t       rawSize()               const { return rawSize_; }
+    uint64_t       compressedSize()        const { return compressedSize_; }
+
+    // LZ4 block format (de)compression, see lz4.github.io/lz4
+    static unsigned int compress(const unsigned char* src,unsigned int srcSize,
+				 unsigned char* dst,unsigned int dstCapacity);
+    static bool         decompress(const unsigned char* src,unsigned int srcSize,
+				   unsigned char* dst,unsigned int dstSize);
+    static unsigned int compressBound(unsigned int srcSize)
+    {
+      return srcSize+srcSize/255+16;
+    }
+
+
+  private:
+    //
+    // private member data
+    //
+    struct Event
+    {
+      unsigned int               evtNumber;
+      std::vector<unsigned int>  fedId;
+      std::vector<unsigned int>  fedSize;
+      std::vector<unsigned int>  compSize;
+      std::vector<unsigned int>  sfFirstFed;
+      std::vector<unsigned char> data;
+    };
+
+    std::vector<Event*>        events_;
+    std::vector<unsigned char> work_;
+    uint64_t                   rawSize_;
+    uint64_t                   compressedSize_;
+
+  };
+
+
+} // namespace evf
+
+
+#endif
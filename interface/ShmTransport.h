@@ -0,0 +1,93 @@
+#ifndef SHMTRANSPORT_H
+#define SHMTRANSPORT_H 1
+
+
+#include "toolbox/mem/Reference.h"
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+
+namespace evf
+{
+
+  //
+  // i2o frames between a BU and a FU on the same host, through a POSIX
+  // shared memory segment with two single producer / single consumer rings:
+  //
+  //   data ring   : BU -> FU, the I2O_FU_TAKE frames of the chains
+  //   return ring : FU -> BU, the I2O_BU_ALLOCATE / I2O_BU_DISCARD frames
+  //
+  // each record is a uint32 frame size and a uint32 flag (LAST: last frame
+  // of a chain) followed by the unmodified i2o frame, padded to 8 bytes. a
+  // chain is published at once, after all its frames were copied. the BU
+  // creates the segment, the FU attaches to it by name
+  //
+  class ShmTransport
+  {
+  public:
+    //
+    // construction/destruction
+    //
+    ShmTransport();
+    virtual ~ShmTransport();
+
+
+    //
+    // member functions
+    //
+    enum Status { SENT, FULL, TOO_LARGE };
+    enum Flag   { LAST=1 };
+
+    bool           create(const std::string& name,
+			  uint64_t dataSize,uint64_t returnSize);
+    bool           attach(const std::string& name);
+    void           close();
+
+    // BU side
+    Status         send(toolbox::mem::Reference* chain);
+    bool           receive(std::vector<unsigned char>& frame);
+
+    // FU side, flags of the frame taken in 'flags'
+    bool           take(std::vector<unsigned char>& frame,unsigned int& flags);
+    Status         reply(const void* frame,unsigned int size);
+
+    bool           isOpen()                const { return 0!=segment_; }
+    uint64_t       nbFramesSent()          const { return nbFramesSent_; }
+    uint64_t       nbFramesReceived()      const { return nbFramesReceived_; }
+    const std::string& error()             const { return error_; }
+
+
+  private:
+    //
+    // private member functions
+    //
+    struct Ring;
+    struct Segment;
+
+    unsigned char* ringData(Ring* ring) const;
+    bool           put(Ring* ring,uint64_t& pos,const void* data,
+		       unsigned int size,unsigned int flags) const;
+    bool           pop(Ring* ring,std::vector<unsigned char>& frame,
+		       unsigned int& flags);
+
+
+    //
+    // member data
+    //
+    std::string    name_;
+    bool           isCreator_;
+    Segment*       segment_;
+    uint64_t       segmentSize_;
+    uint64_t       nbFramesSent_;
+    uint64_t       nbFramesReceived_;
+    std::string    error_;
+
+  };
+
+
+} // namespace evf
+
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef STAGECOUNTERS_H
+#define STAGECOUNTERS_H 1
+
+
+#include <string>
+#include <stdint.h>
+
+
+namespace evf
+{
+
+  //
+  // cycles, instructions and last level cache misses (perf_event_open, per
+  // thread, user space only) and thread cpu time spent in the stages of the
+  // BU, sampled on every 'prescale'th call of each thread and summed up per
+  // stage. on threads without access to the hardware counters only the cpu
+  // time is measured, their samples don't count for the hardware averages
+  //
+  class StageCounters
+  {
+  public:
+    //
+    // construction/destruction
+    //
+    StageCounters();
+    virtual ~StageCounters();
+
+
+    //
+    // member functions
+    //
+    enum Stage   { BUILD, SEND, ALLOCATE, DISCARD, N_STAGES };
+    enum Counter { CYCLES, INSTRUCTIONS, CACHE_MISSES, CPU_NS, N_COUNTERS };
+
+    struct Sample
+    {
+      bool         hasHardware;
+      uint64_t     values[N_COUNTERS];
+    };
+
+    struct Totals
+    {
+      uint64_t     n;
+      uint64_t     nHardware;   // samples with hardware counters
+      uint64_t     values[N_COUNTERS];
+    };
+
+    // 0 disables sampling
+    void           configure(unsigned int prescale);
+
+    // true if this call is sampled, then end() must follow
+    bool           begin(Sample& sample)
+    {
+      if (0==prescale_) return false;
+      return beginSlow(sample);
+    }
+    void           end(Stage stage,const Sample& sample);
+
+    // counts of the stage since the previous call (single caller)
+    void           delta(Stage stage,Totals& totals);
+
+    bool           hasHardwareCounters() const { return nbHwThreads_>0; }
+
+    static const char* stageName(Stage stage);
+
+    // per call costs, e.g. "n=100 cycles=1.2e+06 ... cpuUs=410", the
+    // hardware counters averaged over the samples which have them
+    static std::string format(const Totals& totals);
+
+
+  private:
+    //
+    // private member functions
+    //
+    bool           beginSlow(Sample& sample);
+    bool           read(Sample& sample);
+
+
+    //
+    // member data
+    //
+    volatile unsigned int prescale_;
+    volatile unsigned int nbHwThreads_;
+    volatile uint64_t     totals_[N_STAGES][N_COUNTERS+2];
+    uint64_t              last_[N_STAGES][N_COUNTERS+2];
+
+  };
+
+
+} // namespace evf
+
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef THREADPLACEMENT_H
+#define THREADPLACEMENT_H 1
+
+
+#include <string>
+#include <vector>
+#include <map>
+#include <stdint.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <sys/types.h>
+
+
+namespace evf
+{
+
+  //
+  // cpu affinity and SCHED_FIFO priority of named threads, configured as
+  //
+  //   "<name>:<cpus>[:<priority>];..."   e.g. "building:2-3:50;sending:4"
+  //
+  // where <cpus> is a list like "0-3,8"; threads of a pool (index>=0) are
+  // pinned round-robin to one cpu of the list each. a thread placed before
+  // gets back its original affinity / scheduling once it is no longer
+  // listed, threads never listed are not touched
+  //
+  class ThreadPlacement
+  {
+  public:
+    //
+    // construction/destruction
+    //
+    ThreadPlacement();
+    virtual ~ThreadPlacement();
+
+
+    //
+    // member functions
+    //
+
+    // returns false and leaves the previous configuration on syntax errors
+    bool           configure(const std::string& spec,std::string& error);
+
+    // place the calling thread, returns what was done (empty if nothing)
+    std::string    apply(const std::string& name,int index=-1) const;
+
+    // prefer numa node 'node' for [addr,addr+size), moving existing pages
+    static bool    bindMemory(void* addr,uint64_t size,int node);
+
+    static bool    parseCpuList(const std::string& cpuList,
+				std::vector<int>& cpus);
+
+
+  private:
+    //
+    // private member functions
+    //
+    void           lock()   const { sem_wait(&lock_); }
+    void           unlock() const { sem_post(&lock_); }
+
+
+    //
+    // member data
+    //
+    struct Placement
+    {
+      std::string      cpuList;
+      std::vector<int> cpus;
+      int              priority;
+    };
+
+    // affinity / scheduling of the threads before they were first placed,
+    // by kernel thread id
+    struct Original
+    {
+      cpu_set_t          cpus;
+      int                policy;
+      struct sched_param param;
+    };
+
+    std::map<std::string,Placement> placements_;
+    mutable std::map<pid_t,Original> originals_;
+    mutable sem_t                   lock_;
+
+  };
+
+
+} // namespace evf
+
+
+#endif
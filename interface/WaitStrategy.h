@@ -0,0 +1,84 @@
+#ifndef WAITSTRATEGY_H
+#define WAITSTRATEGY_H 1
+
+
+#include <stdint.h>
+#include <semaphore.h>
+#include <time.h>
+
+
+namespace evf
+{
+
+  //
+  // waits for a semaphore: poll it spinCount times (with pause, only on
+  // machines with more than one cpu), then yieldCount times (with
+  // sched_yield), then block in sem_wait
+  //
+  class WaitStrategy
+  {
+  public:
+    //
+    // construction/destruction
+    //
+    WaitStrategy();
+    virtual ~WaitStrategy();
+
+
+    //
+    // member functions
+    //
+    void           configure(unsigned int spinCount,unsigned int yieldCount);
+
+    void           wait(sem_t* sem)
+    {
+      if (0==sem_trywait(sem)) { nbImmediate_++; return; }
+      waitSlow(sem);
+    }
+
+    // false if the semaphore was not available at once / before deadline
+    bool           tryWait(sem_t* sem)
+    {
+      if (0!=sem_trywait(sem)) return false;
+      nbImmediate_++;
+      return true;
+    }
+    bool           timedWait(sem_t* sem,const struct timespec* deadline)
+    {
+      if (0==sem_trywait(sem)) { nbImmediate_++; return true; }
+      return timedWaitSlow(sem,deadline);
+    }
+
+    // number of waits satisfied at once, while spinning, yielding, or blocking
+    uint64_t       nbImmediate()           const { return nbImmediate_; }
+    uint64_t       nbSpins()               const { return nbSpins_; }
+    uint64_t       nbYields()              const { return nbYields_; }
+    uint64_t       nbSleeps()              const { return nbSleeps_; }
+    void           resetCounters() { nbImmediate_=nbSpins_=nbYields_=nbSleeps_=0; }
+
+
+  private:
+    //
+    // private member functions
+    //
+    void           waitSlow(sem_t* sem);
+    bool           timedWaitSlow(sem_t* sem,const struct timespec* deadline);
+
+
+    //
+    // member data
+    //
+    unsigned int   spinCount_;
+    unsigned int   yieldCount_;
+    uint64_t       nbImmediate_;
+    uint64_t       nbSpins_;
+    uint64_t       nbYields_;
+    uint64_t       nbSleeps_;
+
+  };
+
+
+} // namespace evf
+
+
+#endif
@@ -21,13 +21,26 @@
 #include "xoap/domutils.h"
 
 #include <netinet/in.h>
+#include <cerrno>
+#include <cstddef>
 #include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <functional>
 
 
 using namespace std;
 using namespace evf;
 
 
+namespace {
+  // placement version last applied by the calling workloop thread
+  __thread unsigned int threadPlacementVersion=0;
+  // index of the calling 'serializing' workloop thread in its pool, -1: none
+  __thread int          serializerIndex=-1;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // construction/destruction
 ////////////////////////////////////////////////////////////////////////////////
@@ -38,10 +51,18 @@ BU::BU(xdaq::ApplicationStub *s)
   , log_(getApplicationLogger())
   , buAppDesc_(getApplicationDescriptor())
   , fuAppDesc_(0)
+  , buTid_(0)
+  , fuTid_(0)
   , buAppContext_(getApplicationContext())
   , fsm_(this)
   , gui_(0)
   , evtNumber_(0)
+  , sfMode_(SF_INDEX)
+  , sfCalibN_(0)
+  , replayCacheFull_(false)
+  , replayNext_(0)
+  , genVersion_(0)
+  , evtClass_(-1)
   , isBuilding_(false)
   , isSending_(false)
   , isHalting_(false)
@@ -51,9 +72,53 @@ BU::BU(xdaq::ApplicationStub *s)
   , asSending_(0)
   , wlMonitoring_(0)
   , asMonitoring_(0)
+  , wlReading_(0)
+  , asReading_(0)
+  , isReading_(false)
+  , isReadAhead_(false)
+  , isReadDraining_(false)
+  , wlSampling_(0)
+  , asSampling_(0)
+  , isSampling_(false)
+  , wlLoopback_(0)
+  , asLoopback_(0)
+  , isLoopback_(false)
+  , wlShm_(0)
+  , asShm_(0)
+  , isShmPolling_(false)
+  , isShmStopping_(false)
+  , isShm_(false)
+  , traceMode_(TRACE_NONE)
+  , wlReplaying_(0)
+  , asReplaying_(0)
+  , isReplaying_(false)
+  , isTraceDone_(false)
+  , tracePendingDiscards_(0)
+  , wlValidating_(0)
+  , asValidating_(0)
+  , isValidating_(false)
+  , validateEvery_(1)
+  , nbSerializersActive_(0)
+  , nbSerializersRunning_(0)
+  , nbSerializersIndexed_(0)
+  , isSerializeStopping_(false)
+  , serEvt_(0)
+  , serFuResourceId_(0)
+  , serNSuperFrag_(0)
+  , serNextSuperFrag_(0)
+  , placementVersion_(0)
   , instance_(0)
   , runNumber_(0)
   , memUsedInMB_(0.0)
+  , eventMemInMB_(0.0)
+  , eventMemPeakInMB_(0.0)
+  , replayCacheInMB_(0.0)
+  , lastChainError_("")
+  , placementInfo_("")
+  , eventClassInfo_("")
+  , activeDepth_(0)
+  , depthChangeReason_("")
+  , scanStatus_("")
   , deltaT_(0.0)
   , deltaN_(0)
   , deltaSumOfSquares_(0)
@@ -62,29 +127,115 @@ BU::BU(xdaq::ApplicationStub *s)
   , average_(0.0)
   , rate_(0.0)
   , rms_(0.0)
+  , sendLatencyAvgUs_(0.0)
+  , sendLatencyPeakUs_(0.0)
+  , eventsPerPost_(0.0)
   , nbEventsInBU_(0)
   , nbEventsRequested_(0)
   , nbEventsBuilt_(0)
   , nbEventsSent_(0)
   , nbEventsDiscarded_(0)
+  , nbEventsSampled_(0)
+  , nbEventsSampleDropped_(0)
+  , nbEventsDropped_(0)
+  , nbChainsValidated_(0)
+  , nbChainErrors_(0)
+  , nbWaitImmediate_(0)
+  , nbWaitSpins_(0)
+  , nbWaitYields_(0)
+  , nbWaitSleeps_(0)
+  , nbSlotsReclaimed_(0)
+  , nbLateDiscards_(0)
+  , nbDuplicateDiscards_(0)
+  , nbTraceRecords_(0)
+  , nbShmFullWaits_(0)
   , mode_("RANDOM")
   , replay_(false)
+  , replayCacheSize_(0)
   , crc_(true)
   , overwriteEvtId_(false)
   , overwriteLsId_(false)
   , fakeLsUpdateSecs_(23)
+  , patchCrc_(true)
   , firstEvent_(1)
   , queueSize_(32)
   , eventBufferSize_(0x400000)
+  , eventChunkSize_(0x40000)
+  , eventMemoryMaxInMB_(0)
   , msgBufferSize_(32768)
   , fedSizeMax_(65536)
   , fedSizeMean_(1024)
   , fedSizeWidth_(1024)
   , useFixedFedSize_(false)
+  , payloadPattern_("NONE")
+  , payloadOccupancy_(0.05)
+  , eventClasses_("")
   , monSleepSec_(1)
+  , superFragMode_("INDEX")
+  , superFragTable_("")
+  , nbSuperFrags_(64)
+  , superFragCalibEvents_(100)
+  , readAheadDepth_(0)
+  , samplePrescale_(0)
+  , sampleMinSize_(0)
+  , sampleBufferSize_(0x4000000)
+  , sampleDir_("/tmp")
+  , validatePrescale_(0)
+  , validateCrc_(false)
+  , threadPlacement_("")
+  , numaNode_(-1)
+  , waitStrategy_("BLOCK")
+  , spinCount_(2000)
+  , yieldCount_(10)
+  , discardTimeoutSec_(0)
+  , adaptiveDepth_(false)
+  , depthMin_(4)
+  , depthMargin_(2.0)
+  , perfPrescale_(0)
+  , historySize_(3600)
+  , targetRate_(0.0)
+  , scanSchedule_("")
+  , scanMinStepSec_(10)
+  , scanMaxStepSec_(120)
+  , scanSteadyIntervals_(3)
+  , scanTolerance_(0.05)
+  , loopback_(false)
+  , loopbackDelayUs_(0)
+  , loopbackCredits_(0)
+  , shmName_("")
+  , shmSizeMB_(256)
+  , shmPollUs_(10)
+  , fuTraceMode_("NONE")
+  , fuTraceFile_("/tmp/futrace.bin")
+  , sendBatchSize_(1)
+  , sendBatchBytes_(0)
+  , sendBatchDelayUs_(100)
+  , nbSerializers_(0)
+  , parallelSerializeMinSize_(0x100000)
+  , preSerialize_(false)
+  , ntCopyThreshold_(0)
+  , isPreSerializing_(false)
   , fakeLs_(0)
-  , gaussianMean_(0.0)
-  , gaussianWidth_(1.0)
+  , batchHead_(0)
+  , batchTail_(0)
+  , batchBytes_(0)
+  , sendLatencySumUs_(0.0)
+  , sendLatencyMaxUs_(0.0)
+  , sendLatencyN_(0)
+  , nbPosts_(0)
+  , scanFedSizeMean_(0)
+  , scanFedSizeWidth_(0)
+  , scanRate_(0.0)
+  , histLastCount_(0)
+  , histLastSumUs_(0)
+  , buildRate_(0.0)
+  , nextBuildTime_(0.0)
+  , nbActiveSlots_(0)
+  , discardLatencySum_(0.0)
+  , discardLatencyN_(0)
+  , depthLastRqst_(0)
+  , rqstRateAvg_(0.0)
+  , discardLatencyAvg_(0.0)
   , monLastN_(0)
   , monLastSumOfSquares_(0)
   , monLastSumOfSizes_(0)
@@ -146,15 +297,16 @@ BU::BU(xdaq::ApplicationStub *s)
   // findRcmsStateListener
   fsm_.findRcmsStateListener();
   
-  // compute parameters for fed size generation (a la Emilio)
-  gaussianMean_ =std::log((double)fedSizeMean_);
-  gaussianWidth_=std::sqrt(std::log
-			   (0.5*
-			    (1+std::sqrt
-			     (1.0+4.0*
-			      fedSizeWidth_.value_*fedSizeWidth_.value_/
-			      fedSizeMean_.value_/fedSizeMean_.value_))));
-
+  // parameters for fed size generation, updated by actionPerformed()
+  string error;
+  if (!publishGeneratorConfig(error))
+    LOG4CPLUS_ERROR(log_,"Invalid generator parameters: "<<error);
+
+  // serializing workloops are started at Enable, stopped at Stop / Halt
+  sem_init(&serializeSem_,0,0);
+  sem_init(&serializeDoneSem_,0,0);
+  sem_init(&serializeMutex_,0,1);
+  
   // start monitoring thread, once and for all
   startMonitoringWorkLoop();
   
@@ -181,6 +333,59 @@ bool BU::configuring(toolbox::task::WorkLoop* wl)
   try {
     LOG4CPLUS_INFO(log_,"Start configuring ...");
     reset();
+    if      (superFragMode_.value_=="INDEX")    sfMode_=SF_INDEX;
+    else if (superFragMode_.value_=="TABLE")    sfMode_=SF_TABLE;
+    else if (superFragMode_.value_=="BALANCED") sfMode_=SF_BALANCED;
+    else XCEPT_RAISE(evf::Exception,
+		     "Invalid superFragMode '"+superFragMode_.value_+"'.");
+    if (sfMode_==SF_TABLE) loadSuperFragTable();
+    if (sfMode_==SF_BALANCED&&nbSuperFrags_.value_>1024)
+      XCEPT_RAISE(evf::Exception,
+		  "nbSuperFrags "+nbSuperFrags_.toString()+" exceeds 1024.");
+    if (!payload_.configure(payloadPattern_.value_,payloadOccupancy_.value_))
+      XCEPT_RAISE(evf::Exception,
+		  "Invalid payloadPattern '"+payloadPattern_.value_+
+		  "' or payloadOccupancy "+payloadOccupancy_.toString()+".");
+    if      (fuTraceMode_.value_=="NONE")   traceMode_=TRACE_NONE;
+    else if (fuTraceMode_.value_=="RECORD") traceMode_=TRACE_RECORD;
+    else if (fuTraceMode_.value_=="REPLAY") traceMode_=TRACE_REPLAY;
+    else XCEPT_RAISE(evf::Exception,
+		     "Invalid fuTraceMode '"+fuTraceMode_.value_+"'.");
+    unsigned int spinCount=0,yieldCount=0;
+    if (waitStrategy_.value_=="ADAPTIVE") {
+      spinCount =spinCount_.value_;
+      yieldCount=yieldCount_.value_;
+    }
+    else if (waitStrategy_.value_!="BLOCK")
+      XCEPT_RAISE(evf::Exception,
+		  "Invalid waitStrategy '"+waitStrategy_.value_+"'.");
+    buildWait_.configure(spinCount,yieldCount);
+    sendWait_.configure(spinCount,yieldCount);
+    rqstWait_.configure(spinCount,yieldCount);
+    string error;
+    if (!placement_.configure(threadPlacement_.value_,error))
+      XCEPT_RAISE(evf::Exception,"Invalid threadPlacement: "+error);
+    stageCounters_.configure(perfPrescale_.value_);
+    if (!scan_.configure(scanSchedule_.value_,scanMinStepSec_.value_,
+			 scanMaxStepSec_.value_,scanSteadyIntervals_.value_,
+			 scanTolerance_.value_,error))
+      XCEPT_RAISE(evf::Exception,"Invalid scanSchedule: "+error);
+    history_.configure(historySize_.value_);
+    FastCopy::configure(ntCopyThreshold_.value_);
+    if (FastCopy::threshold()>0)
+      LOG4CPLUS_INFO(log_,"fed data copies of "<<FastCopy::threshold()
+		     <<" bytes and more with "<<FastCopy::kernelName()
+		     <<" non-temporal stores.");
+    if (!publishGeneratorConfig(error))
+      XCEPT_RAISE(evf::Exception,"Invalid generator parameters: "+error);
+    gui_->monInfoSpace()->lock();
+    placedThreads_.clear();
+    if (numaNode_.value_>=0) {
+      ostringstream oss; oss<<"numa node "<<numaNode_.value_;
+      placedThreads_["events"]=oss.str();
+    }
+    gui_->monInfoSpace()->unlock();
+    __sync_fetch_and_add(&placementVersion_,1);
     LOG4CPLUS_INFO(log_,"Finished configuring!");
     fsm_.fireEvent("ConfigureDone",this);
   }
@@ -209,8 +414,55 @@ bool BU::enabling(toolbox::task::WorkLoop* wl)
       for (unsigned int i=0;i<(unsigned int)FEDNumbering::MAXFEDID+1;i++)
 	if (FEDNumbering::inRangeNoGT(i)) validFedIds_.push_back(i);
     }
+    initSuperFrags(vector<double>(FEDNumbering::MAXFEDID+1,1.0));
+    // again, to check the event classes against the valid feds
+    string error;
+    if (!publishGeneratorConfig(error))
+      XCEPT_RAISE(evf::Exception,"Invalid generator parameters: "+error);
+    GeneratorConfig::Settings gen;
+    genConfig_.current(gen);
+    if (gen.eventClasses.size()>0&&0!=PlaybackRawDataProvider::instance())
+      LOG4CPLUS_WARN(log_,"eventClasses are ignored in PLAYBACK mode.");
+    isReadAhead_=(0!=PlaybackRawDataProvider::instance()&&readAheadDepth_>0);
+    if (isReadAhead_&&!isReading_) startReadingWorkLoop();
+    if ((samplePrescale_>0||sampleMinSize_>0)&&!isSampling_)
+      startSamplingWorkLoop();
+    if (validatePrescale_>0&&!isValidating_) startValidatingWorkLoop();
+    buTid_=i2o::utils::getAddressMap()->getTid(buAppDesc_);
+    if (traceMode_==TRACE_RECORD&&!fuTrace_.openRecord(fuTraceFile_.value_))
+      XCEPT_RAISE(evf::Exception,"Failed to record FU trace: "+fuTrace_.error());
+    if (traceMode_==TRACE_REPLAY) {
+      if (!fuTrace_.openReplay(fuTraceFile_.value_))
+	XCEPT_RAISE(evf::Exception,"Failed to replay FU trace: "+fuTrace_.error());
+      if (loopback_.value_)
+	LOG4CPLUS_WARN(log_,"FU trace replayed, loopback is ignored.");
+      fuTid_=buTid_;
+    }
+    else if (loopback_.value_) {
+      fuTid_=buTid_;
+      if (!isLoopback_) startLoopbackWorkLoop();
+    }
+    isShm_=(!shmName_.value_.empty()&&traceMode_!=TRACE_REPLAY&&!loopback_.value_);
+    if (isShm_) {
+      if (!shm_.create(shmName_.value_,(uint64_t)shmSizeMB_.value_<<20,1<<20))
+	XCEPT_RAISE(evf::Exception,"Failed to create shm transport: "+shm_.error());
+      if (!isShmPolling_) startShmWorkLoop();
+    }
+    else if (!shmName_.value_.empty())
+      LOG4CPLUS_WARN(log_,"shm transport is ignored with loopback / FU trace replay.");
+    if (scan_.isConfigured()) startScan();
+    isPreSerializing_=preSerialize_.value_;
     if (!isBuilding_) startBuildingWorkLoop();
     if (!isSending_)  startSendingWorkLoop();
+    startSerializingWorkLoops();
+    if (traceMode_==TRACE_REPLAY) {
+      if (!isReplaying_) startReplayingWorkLoop();
+    }
+    else if (loopback_.value_) {
+      unsigned int nbCredits=loopbackCredits_.value_;
+      if (0==nbCredits) nbCredits=queueSize_.value_;
+      for (unsigned int i=0;i<nbCredits;i++) allocate(i);
+    }
     LOG4CPLUS_INFO(log_,"Finished enabling!");
     fsm_.fireEvent("EnableDone",this);
   }
@@ -229,8 +481,7 @@ bool BU::stopping(toolbox::task::WorkLoop* wl)
   try {
     LOG4CPLUS_INFO(log_,"Start stopping :) ...");
 
-    if (0!=PlaybackRawDataProvider::instance()&&
-	(!replay_.value_||nbEventsBuilt_<(uint32_t)events_.size())) { 
+    if (isPlaybackRunning()) { 
       lock();
       freeIds_.push(events_.size()); 
       unlock();
@@ -241,19 +492,29 @@ bool BU::stopping(toolbox::task::WorkLoop* wl)
       }
       // let the playback go to the last event and exit
       PlaybackRawDataProvider::instance()->setFreeToEof(); 
+      stopReadAhead();
       while (!PlaybackRawDataProvider::instance()->areFilesClosed()) usleep(1000000);
       usleep(100000);
     }
+    waitReadAhead();
+    stopSampling();
+    if (scan_.isActive()) { scan_.stop(); applyScanStep(); }
     
     lock();
     builtIds_.push(events_.size());
     unlock();
 
     postSend();
+    stopReplaying();
     while (!sentIds_.empty()) {
       LOG4CPLUS_INFO(log_,"wait to flush ...");
       ::sleep(1);
     }
+    stopLoopback();
+    stopShm();
+    stopValidating();
+    stopSerializing();
+    fuTrace_.close();
     reset();
     /* this is not needed and should not run if reset is called
     if (0!=PlaybackRawDataProvider::instance()&&
@@ -289,12 +550,21 @@ bool BU::halting(toolbox::task::WorkLoop* wl)
       postBuild();
       postSend();
     }
-    if (0!=PlaybackRawDataProvider::instance()&&
-	(!replay_.value_||nbEventsBuilt_<(uint32_t)events_.size())) { 
+    if (isPlaybackRunning()) { 
       PlaybackRawDataProvider::instance()->setFreeToEof();
+      stopReadAhead();
       while (!PlaybackRawDataProvider::instance()->areFilesClosed()) usleep(1000000);
       usleep(100000);
     }
+    waitReadAhead();
+    stopSampling();
+    if (scan_.isActive()) { scan_.stop(); applyScanStep(); }
+    stopValidating();
+    stopLoopback();
+    stopShm();
+    stopReplaying();
+    stopSerializing();
+    fuTrace_.close();
     LOG4CPLUS_INFO(log_,"Finished halting!");
     fsm_.fireEvent("HaltDone",this);
   }
@@ -329,21 +599,18 @@ void BU::I2O_BU_ALLOCATE_Callback(toolbox::mem::Reference *bufRef)
   stdMsg=(I2O_MESSAGE_FRAME*)bufRef->getDataLocation();
   msg   =(I2O_BU_ALLOCATE_MESSAGE_FRAME*)stdMsg;
   
+  if (traceMode_==TRACE_REPLAY) {
+    bufRef->release();
+    return;
+  }
+  
   if (0==fuAppDesc_) {
     I2O_TID fuTid=stdMsg->InitiatorAddress;
     fuAppDesc_=i2o::utils::getAddressMap()->getApplicationDescriptor(fuTid);
+    fuTid_=fuTid;
   }
   
-  for (unsigned int i=0;i<msg->n;i++) {
-    unsigned int fuResourceId=msg->allocate[i].fuTransactionId;
-    lock();
-    rqstIds_.push(fuResourceId);
-    postRqst();
-    nbEventsRequested_++;
-    nbEventsInBU_++;
-    unlock();
-  }
-
+  allocateFrame(msg);
   bufRef->release();
 }
 
@@ -359,23 +626,13 @@ void BU::I2O_BU_DISCARD_Callback(toolbox::mem::Reference *bufRef)
 
   I2O_MESSAGE_FRAME           *stdMsg=(I2O_MESSAGE_FRAME*)bufRef->getDataLocation();
   I2O_BU_DISCARD_MESSAGE_FRAME*msg   =(I2O_BU_DISCARD_MESSAGE_FRAME*)stdMsg;
-  unsigned int buResourceId=msg->buResourceId[0];
-
-  lock();
-  int result=sentIds_.erase(buResourceId);
-  unlock();
   
-  if (!result) {
-    LOG4CPLUS_ERROR(log_,"can't discard unknown buResourceId '"<<buResourceId<<"'");
-  }
-  else {
-    lock();
-    freeIds_.push(buResourceId);
-    nbEventsDiscarded_.value_++;
-    unlock();
-    postBuild();
+  if (traceMode_==TRACE_REPLAY) {
+    bufRef->release();
+    return;
   }
   
+  discardFrame(msg);
   bufRef->release();
 }
 
@@ -388,10 +645,20 @@ void BU::actionPerformed(xdata::Event& e)
     mode_=(0==PlaybackRawDataProvider::instance())?"RANDOM":"PLAYBACK";
     if (0!=i2oPool_) memUsedInMB_=i2oPool_->getMemoryUsage().getUsed()*9.53674e-07;
     else             memUsedInMB_=0.0;
+    eventMemInMB_    =eventPool_.used()*9.53674e-07;
+    eventMemPeakInMB_=eventPool_.peakUsed()*9.53674e-07;
+    memUsedInMB_     =memUsedInMB_+eventMemInMB_;
+    replayCacheInMB_=replayCache_.compressedSize()*9.53674e-07;
   }
   else if (e.type()=="ItemChangedEvent") {
+    // RANDOM mode parameters take effect with the next event built
     string item=dynamic_cast<xdata::ItemChangedEvent&>(e).itemName();
-    if (item=="crc") BUEvent::setComputeCrc(crc_.value_);
+    string error;
+    if (!publishGeneratorConfig(error))
+      LOG4CPLUS_ERROR(log_,"Ignored new value of "<<item<<": "<<error);
+    else
+      LOG4CPLUS_INFO(log_,"Generator parameters version "<<genConfig_.version()
+		     <<" published ("<<item<<").");
   }
   gui_->monInfoSpace()->unlock();
 }
@@ -411,7 +678,41 @@ void BU::webPageRequest(xgi::Input *in,xgi::Output *out)
 void BU::customWebPage(xgi::Input*in,xgi::Output*out)
   throw (xgi::exception::Exception)
 {
-  *out<<"<html></html>"<<endl;
+  // metrics as of the last monitoring update: ?format=json (default) or
+  // ?format=openmetrics, never waiting for any BU lock; ?format=history
+  // and ?format=scan for the past intervals and the scan results
+  string query=in->getenv("QUERY_STRING");
+  bool   openMetrics=(query.find("format=openmetrics")!=string::npos||
+		      query.find("format=prometheus")!=string::npos);
+  
+  if (query.find("format=history")!=string::npos) {
+    vector<MonitorHistory::Entry> entries;
+    history_.entries(entries);
+    out->getHTTPResponseHeader().addHeader("Content-Type","application/json");
+    MonitorHistory::writeJson(*out,entries);
+    return;
+  }
+  if (query.find("format=scan")!=string::npos) {
+    vector<LoadScan::Result> results;
+    scan_.results(results);
+    out->getHTTPResponseHeader().addHeader("Content-Type","text/plain");
+    LoadScan::writeTable(*out,results);
+    return;
+  }
+  
+  MetricsSnapshot::Data data;
+  if (!metrics_.read(data)) memset(&data,0,sizeof(data));
+  
+  if (openMetrics) {
+    out->getHTTPResponseHeader().addHeader("Content-Type",
+					    "application/openmetrics-text; "
+					    "version=1.0.0; charset=utf-8");
+    MetricsSnapshot::writeOpenMetrics(*out,data,sourceId_);
+  }
+  else {
+    out->getHTTPResponseHeader().addHeader("Content-Type","application/json");
+    MetricsSnapshot::writeJson(*out,data,sourceId_);
+  }
 }
 
 
@@ -439,6 +740,7 @@ void BU::startBuildingWorkLoop() throw (evf::Exception)
 //______________________________________________________________________________
 bool BU::building(toolbox::task::WorkLoop* wl)
 {
+  placeThread("building");
   waitBuild();
   lock();
   unsigned int buResourceId=freeIds_.front(); freeIds_.pop();
@@ -452,10 +754,45 @@ bool BU::building(toolbox::task::WorkLoop* wl)
   
   if (!isHalting_) {
     BUEvent* evt=events_[buResourceId];
-    if(generateEvent(evt)) {
+    if (buildRate_>0.0) paceBuilding();
+    // only RANDOM events are generated from the settings; PLAYBACK may
+    // block on its files and must not hold up publishGeneratorConfig()
+    bool isRandom=(0==PlaybackRawDataProvider::instance()&&!replayCacheFull_);
+    const GeneratorConfig::Settings& gen=genConfig_.acquire();
+    if (gen.version!=genVersion_) useGeneratorConfig(gen);
+    if (!isRandom) genConfig_.release();
+    StageCounters::Sample sample;
+    bool sampled=stageCounters_.begin(sample);
+    bool built  =generateEvent(evt,gen);
+    if (sampled) stageCounters_.end(StageCounters::BUILD,sample);
+    if (isRandom) genConfig_.release();
+    if (built&&evt->isTruncated()) {
+      // out of event memory: never post a truncated event, drop it and give
+      // the chunks back, then retry once discards freed some memory
+      evt->initialize(evt->evtNumber());
+      lock();
+      nbEventsDropped_++;
+      bool free=releaseSlot(buResourceId);
+      unlock();
+      if (1==nbEventsDropped_.value_%1000)
+	LOG4CPLUS_WARN(log_,"out of event memory, "<<nbEventsDropped_.value_
+		       <<" events dropped so far.");
+      usleep(1000);
+      if (free) postBuild();
+    }
+    else if (built) {
+      if (isSampling_) sampler_.sample(evt);
+      // the sender fills in fuTransactionId / TargetAddress, see sending()
+      if (isPreSerializing_) {
+	sampled=stageCounters_.begin(sample);
+	chains_[buResourceId]=createMsgChain(evt,0);
+	if (sampled) stageCounters_.end(StageCounters::SEND,sample);
+      }
       lock();
       nbEventsBuilt_++;
+      if (evtClass_>=0) evtClassCounts_[evtClass_]++;
       builtIds_.push(buResourceId);
+      gettimeofday(&builtTimes_[buResourceId],0);
       unlock();
       
       postSend();
@@ -499,25 +836,55 @@ void BU::startSendingWorkLoop() throw (evf::Exception)
 //______________________________________________________________________________
 bool BU::sending(toolbox::task::WorkLoop* wl)
 {
-  waitSend();
+  placeThread("sending");
+  
+  // a pending batch is posted at its deadline at the latest
+  if (0!=batchHead_) {
+    if (!waitSend(&batchDeadline_)) {
+      flushBatch();
+      return true;
+    }
+  }
+  else waitSend();
+  
   lock();
   unsigned int buResourceId=builtIds_.front(); builtIds_.pop();
   unlock();
   
   if (buResourceId>=(uint32_t)events_.size()) {
+    flushBatch();
     LOG4CPLUS_INFO(log_,"shutdown 'sending' workloop.");
     isSending_=false;
     return false;
   }
 
   if (!isHalting_) {
-    waitRqst();
+    // don't hold back a batch while waiting for the FU
+    if (0==batchHead_) waitRqst();
+    else if (!tryRqst()) { flushBatch(); waitRqst(); }
     lock();
     unsigned int fuResourceId=rqstIds_.front(); rqstIds_.pop();
     unlock();
     
     BUEvent* evt=events_[buResourceId];
-    toolbox::mem::Reference* msg=createMsgChain(evt,fuResourceId);
+    toolbox::mem::Reference* msg=chains_[buResourceId];
+    if (0!=msg) {
+      chains_[buResourceId]=0;
+      for (toolbox::mem::Reference* ref=msg;0!=ref;ref=ref->getNextReference()) {
+	I2O_EVENT_DATA_BLOCK_MESSAGE_FRAME* block=
+	  (I2O_EVENT_DATA_BLOCK_MESSAGE_FRAME*)ref->getDataLocation();
+	block->fuTransactionId=fuResourceId;
+	block->PvtMessageFrame.StdMessageFrame.TargetAddress=fuTid_;
+      }
+    }
+    else {
+      StageCounters::Sample sample;
+      bool sampled=stageCounters_.begin(sample);
+      msg=createMsgChain(evt,fuResourceId);
+      if (sampled) stageCounters_.end(StageCounters::SEND,sample);
+    }
+    if (isValidating_&&nbEventsSent_.value_%validateEvery_==0)
+      validator_.submit(msg,evt,fuResourceId);
     
     lock();
     sumOfSquares_+=(uint64_t)evt->evtSize()*(uint64_t)evt->evtSize();
@@ -525,9 +892,10 @@ bool BU::sending(toolbox::task::WorkLoop* wl)
     nbEventsInBU_--;
     nbEventsSent_++;
     sentIds_.insert(buResourceId);
+    gettimeofday(&sentTimes_[buResourceId],0);
     unlock();
     
-    buAppContext_->postFrame(msg,buAppDesc_,fuAppDesc_);  
+    postChain(msg);
   }
   
   return true;
@@ -535,267 +903,1752 @@ bool BU::sending(toolbox::task::WorkLoop* wl)
 
 
 //______________________________________________________________________________
-void BU::startMonitoringWorkLoop() throw (evf::Exception)
+void BU::startReadingWorkLoop() throw (evf::Exception)
 {
-  struct timezone timezone;
-  gettimeofday(&monStartTime_,&timezone);
-  
   try {
-    LOG4CPLUS_INFO(log_,"Start 'monitoring' workloop");
-    wlMonitoring_=
-      toolbox::task::getWorkLoopFactory()->getWorkLoop(sourceId_+
-						       "Monitoring",
-						       "waiting");
-    if (!wlMonitoring_->isActive()) wlMonitoring_->activate();
-    asMonitoring_=toolbox::task::bind(this,&BU::monitoring,sourceId_+"Monitoring");
-    wlMonitoring_->submit(asMonitoring_);
+    LOG4CPLUS_INFO(log_,"Start 'reading' workloop");
+    isReadDraining_=false;
+    wlReading_=toolbox::task::getWorkLoopFactory()->getWorkLoop(sourceId_+
+								"Reading",
+								"waiting");
+    if (!wlReading_->isActive()) wlReading_->activate();
+    
+    asReading_=toolbox::task::bind(this,&BU::reading,sourceId_+"Reading");
+    wlReading_->submit(asReading_);
+    isReading_=true;
   }
   catch (xcept::Exception& e) {
-    string msg = "Failed to start workloop 'monitoring'.";
+    string msg = "Failed to start workloop 'reading'.";
     XCEPT_RETHROW(evf::Exception,msg,e);
   }
 }
 
 
 //______________________________________________________________________________
-bool BU::monitoring(toolbox::task::WorkLoop* wl)
+bool BU::reading(toolbox::task::WorkLoop* wl)
 {
-  struct timeval  monEndTime;
-  struct timezone timezone;
+  placeThread("reading");
   
-  gettimeofday(&monEndTime,&timezone);
+  // once draining, read without waiting for the builder until the end
+  if (!isReadDraining_) sem_wait(&readSlotSem_);
+  
+  ReadEvent read;
+  read.event=PlaybackRawDataProvider::instance()->getFEDRawData(read.runNumber,
+								 read.evtNumber);
+  if (0!=read.event) {
+    if (!isReadDraining_) {
+      lock();
+      readEvents_.push(read);
+      unlock();
+      sem_post(&readReadySem_);
+    }
+    else delete read.event;
+    return true;
+  }
   
+  // end of playback: drop what wasn't built when draining, then pass the
+  // null event on to the builder (which may be waiting for it)
   lock();
-  unsigned int monN           =nbEventsBuilt_.value_;
-  uint64_t     monSumOfSquares=sumOfSquares_;
-  unsigned int monSumOfSizes  =sumOfSizes_;
-  uint64_t     deltaSumOfSquares;
+  if (isReadDraining_) {
+    while (!readEvents_.empty()) {
+      delete readEvents_.front().event;
+      readEvents_.pop();
+    }
+  }
+  readEvents_.push(read);
   unlock();
+  sem_post(&readReadySem_);
   
-  gui_->monInfoSpace()->lock();
-  
-  deltaT_.value_=deltaT(&monStartTime_,&monEndTime);
-  monStartTime_=monEndTime;
-  
-  deltaN_.value_=monN-monLastN_;
-  monLastN_=monN;
+  LOG4CPLUS_INFO(log_,"shutdown 'reading' workloop.");
+  isReading_=false;
+  return false;
+}
 
-  deltaSumOfSquares=monSumOfSquares-monLastSumOfSquares_;
-  deltaSumOfSquares_.value_=(double)deltaSumOfSquares;
-  monLastSumOfSquares_=monSumOfSquares;
-  
-  deltaSumOfSizes_.value_=monSumOfSizes-monLastSumOfSizes_;
-  monLastSumOfSizes_=monSumOfSizes;
-  
-  if (deltaT_.value_!=0) {
-    throughput_=deltaSumOfSizes_.value_/deltaT_.value_;
-    rate_      =deltaN_.value_/deltaT_.value_;
-  }
-  else {
-    throughput_=0.0;
-    rate_      =0.0;
+
+//______________________________________________________________________________
+void BU::startSamplingWorkLoop() throw (evf::Exception)
+{
+  ostringstream oss;
+  oss<<sampleDir_.toString()<<"/"<<sourceId_<<"_run"<<runNumber_.value_<<".evs";
+  if (!sampler_.open(oss.str(),sampleBufferSize_,samplePrescale_,sampleMinSize_)) {
+    LOG4CPLUS_ERROR(log_,"Can't open "<<oss.str()<<", no events are sampled.");
+    return;
   }
   
-  double meanOfSquares,mean,squareOfMean,variance;
-  
-  if(deltaN_.value_!=0) {
-    meanOfSquares=deltaSumOfSquares_.value_/((double)(deltaN_.value_));
-    mean=((double)(deltaSumOfSizes_.value_))/((double)(deltaN_.value_));
-    squareOfMean=mean*mean;
-    variance=meanOfSquares-squareOfMean;
-    average_=deltaSumOfSizes_.value_/deltaN_.value_;
-    rms_    =std::sqrt(variance);
+  try {
+    LOG4CPLUS_INFO(log_,"Start 'sampling' workloop, writing to "<<oss.str());
+    wlSampling_=toolbox::task::getWorkLoopFactory()->getWorkLoop(sourceId_+
+								 "Sampling",
+								 "waiting");
+    if (!wlSampling_->isActive()) wlSampling_->activate();
+    
+    asSampling_=toolbox::task::bind(this,&BU::sampling,sourceId_+"Sampling");
+    wlSampling_->submit(asSampling_);
+    isSampling_=true;
   }
-  else {
-    average_=0.0;
-    rms_    =0.0;
+  catch (xcept::Exception& e) {
+    string msg = "Failed to start workloop 'sampling'.";
+    XCEPT_RETHROW(evf::Exception,msg,e);
   }
-
-  gui_->monInfoSpace()->unlock();
-  
-  ::sleep(monSleepSec_.value_);
-
-  return true;
 }
-    
 
 
-////////////////////////////////////////////////////////////////////////////////
-// implementation of private member functions
-////////////////////////////////////////////////////////////////////////////////
-
 //______________________________________________________________________________
-void BU::exportParameters()
+bool BU::sampling(toolbox::task::WorkLoop* wl)
 {
-  if (0==gui_) {
-    LOG4CPLUS_ERROR(log_,"No GUI, can't export parameters");
-    return;
-  }
+  placeThread("sampling");
+  if (sampler_.write()) return true;
   
-  gui_->addMonitorParam("url",                &url_);
-  gui_->addMonitorParam("class",              &class_);
-  gui_->addMonitorParam("instance",           &instance_);
-  gui_->addMonitorParam("hostname",           &hostname_);
-  gui_->addMonitorParam("runNumber",          &runNumber_);
-  gui_->addMonitorParam("stateName",          fsm_.stateName());
-  gui_->addMonitorParam("memUsedInMB",        &memUsedInMB_);
-  gui_->addMonitorParam("deltaT",             &deltaT_);
-  gui_->addMonitorParam("deltaN",             &deltaN_);
-  gui_->addMonitorParam("deltaSumOfSquares",  &deltaSumOfSquares_);
-  gui_->addMonitorParam("deltaSumOfSizes",    &deltaSumOfSizes_);
-  gui_->addMonitorParam("throughput",         &throughput_);
-  gui_->addMonitorParam("average",            &average_);
-  gui_->addMonitorParam("rate",               &rate_);
-  gui_->addMonitorParam("rms",                &rms_);
+  LOG4CPLUS_INFO(log_,"shutdown 'sampling' workloop, "<<sampler_.nbWritten()
+		 <<" events written to "<<sampler_.fileName());
+  isSampling_=false;
+  return false;
+}
 
-  gui_->addMonitorCounter("nbEvtsInBU",       &nbEventsInBU_);
-  gui_->addMonitorCounter("nbEvtsRequested",  &nbEventsRequested_);
-  gui_->addMonitorCounter("nbEvtsBuilt",      &nbEventsBuilt_);
-  gui_->addMonitorCounter("nbEvtsSent",       &nbEventsSent_);
-  gui_->addMonitorCounter("nbEvtsDiscarded",  &nbEventsDiscarded_);
 
-  gui_->addStandardParam("mode",              &mode_);
-  gui_->addStandardParam("replay",            &replay_);
-  gui_->addStandardParam("overwriteEvtId",    &overwriteEvtId_);
-  gui_->addStandardParam("overwriteLsId",     &overwriteLsId_);
-  gui_->addStandardParam("fakeLsUpdateSecs",   &fakeLsUpdateSecs_);
-  gui_->addStandardParam("crc",               &crc_);
-  gui_->addStandardParam("firstEvent",        &firstEvent_);
-  gui_->addStandardParam("queueSize",         &queueSize_);
-  gui_->addStandardParam("eventBufferSize",   &eventBufferSize_);
-  gui_->addStandardParam("msgBufferSize",     &msgBufferSize_);
-  gui_->addStandardParam("fedSizeMax",        &fedSizeMax_);
-  gui_->addStandardParam("fedSizeMean",       &fedSizeMean_);
-  gui_->addStandardParam("fedSizeWidth",      &fedSizeWidth_);
-  gui_->addStandardParam("useFixedFedSize",   &useFixedFedSize_);
-  gui_->addStandardParam("monSleepSec",       &monSleepSec_);
-  gui_->addStandardParam("rcmsStateListener",     fsm_.rcmsStateListener());
-  gui_->addStandardParam("foundRcmsStateListener",fsm_.foundRcmsStateListener());
+//______________________________________________________________________________
+void BU::stopSampling()
+{
+  if (!isSampling_) return;
+  sampler_.close();
+  while (isSampling_) ::usleep(10000);
+}
 
-  
-  gui_->exportParameters();
 
-  gui_->addItemChangedListener("crc",this);
-  
+//______________________________________________________________________________
+void BU::startLoopbackWorkLoop() throw (evf::Exception)
+{
+  try {
+    LOG4CPLUS_INFO(log_,"Start 'loopback' workloop, FU emulated with "
+		   <<loopbackDelayUs_.value_<<" us delay");
+    wlLoopback_=toolbox::task::getWorkLoopFactory()->getWorkLoop(sourceId_+
+								 "Loopback",
+								 "waiting");
+    if (!wlLoopback_->isActive()) wlLoopback_->activate();
+    
+    asLoopback_=toolbox::task::bind(this,&BU::loopback,sourceId_+"Loopback");
+    wlLoopback_->submit(asLoopback_);
+    isLoopback_=true;
+  }
+  catch (xcept::Exception& e) {
+    string msg = "Failed to start workloop 'loopback'.";
+    XCEPT_RETHROW(evf::Exception,msg,e);
+  }
 }
 
 
 //______________________________________________________________________________
-void BU::reset()
+bool BU::loopback(toolbox::task::WorkLoop* wl)
 {
-  gui_->resetCounters();
+  placeThread("loopback");
   
-  deltaT_             =0.0;
-  deltaN_             =  0;
-  deltaSumOfSquares_  =  0;
-  deltaSumOfSizes_    =  0;
-  
-  throughput_         =0.0;
-  average_            =  0;
-  rate_               =  0;
-  rms_                =  0;
-
-  monLastN_           =  0;
-  monLastSumOfSquares_=  0;
-  monLastSumOfSizes_  =  0;
+  sem_wait(&loopbackSem_);
+  lock();
+  LoopbackChain chain=loopbackChains_.front(); loopbackChains_.pop();
+  unlock();
   
-  while (events_.size()) {
-    delete events_.back();
-    events_.pop_back();
+  if (0==chain.msg) {
+    LOG4CPLUS_INFO(log_,"shutdown 'loopback' workloop.");
+    isLoopback_=false;
+    return false;
   }
   
-  while (!rqstIds_.empty())  rqstIds_.pop();
-  while (!freeIds_.empty())  freeIds_.pop();
-  while (!builtIds_.empty()) builtIds_.pop();
-  sentIds_.clear();
- 
-  sem_init(&lock_,0,1);
-  sem_init(&buildSem_,0,queueSize_);
-  sem_init(&sendSem_,0,0);
-  sem_init(&rqstSem_,0,0);
+  // chains are queued in the order they are due
+  struct timeval now;
+  gettimeofday(&now,0);
+  long waitUs=(chain.due.tv_sec-now.tv_sec)*1000000+
+    (chain.due.tv_usec-now.tv_usec);
+  if (waitUs>0) ::usleep(waitUs);
   
-  for (unsigned int i=0;i<queueSize_;i++) {
-    events_.push_back(new BUEvent(i,eventBufferSize_));
-    freeIds_.push(i);
+  // take the event like the FU would, then give back slot and credit
+  I2O_EVENT_DATA_BLOCK_MESSAGE_FRAME *block=
+    (I2O_EVENT_DATA_BLOCK_MESSAGE_FRAME*)chain.msg->getDataLocation();
+  unsigned int buResourceId=block->buResourceId;
+  unsigned int fuResourceId=block->fuTransactionId;
+  chain.msg->release();
+  
+  if (!isHalting_) {
+    discard(buResourceId);
+    allocate(fuResourceId);
   }
-  validFedIds_.clear();
-  fakeLs_=0;
+  return true;
 }
 
+
 //______________________________________________________________________________
-double BU::deltaT(const struct timeval *start,const struct timeval *end)
+void BU::stopLoopback()
 {
-  unsigned int  sec;
-  unsigned int  usec;
-  
-  sec = end->tv_sec - start->tv_sec;
-  
-  if(end->tv_usec > start->tv_usec) {
-    usec = end->tv_usec - start->tv_usec;
-  }
-  else {
-    sec--;
-    usec = 1000000 - ((unsigned int )(start->tv_usec - end->tv_usec));
-  }
-  
-  return ((double)sec) + ((double)usec) / 1000000.0;
+  if (!isLoopback_) return;
+  LoopbackChain chain;
+  chain.msg=0;
+  lock();
+  loopbackChains_.push(chain);
+  unlock();
+  sem_post(&loopbackSem_);
+  while (isLoopback_) ::usleep(10000);
 }
 
 
 //______________________________________________________________________________
-bool BU::generateEvent(BUEvent* evt)
+void BU::startShmWorkLoop() throw (evf::Exception)
 {
-  // replay?
-  if (replay_.value_&&nbEventsBuilt_>=(uint32_t)events_.size()) 
-    {
-      if (0!=PlaybackRawDataProvider::instance())
-        PlaybackRawDataProvider::instance()->setFreeToEof();
-      return true;
-    }  
+  try {
+    LOG4CPLUS_INFO(log_,"Start 'shm' workloop, frames to the FU through "
+		   <<shmName_.value_);
+    wlShm_=toolbox::task::getWorkLoopFactory()->getWorkLoop(sourceId_+"Shm",
+							    "waiting");
+    if (!wlShm_->isActive()) wlShm_->activate();
+    
+    isShmStopping_=false;
+    asShm_=toolbox::task::bind(this,&BU::shmPolling,sourceId_+"Shm");
+    wlShm_->submit(asShm_);
+    isShmPolling_=true;
+  }
+  catch (xcept::Exception& e) {
+    string msg = "Failed to start workloop 'shm'.";
+    XCEPT_RETHROW(evf::Exception,msg,e);
+  }
+}
+
+
+//______________________________________________________________________________
+bool BU::shmPolling(toolbox::task::WorkLoop* wl)
+{
+  placeThread("shm");
+  
+  if (isShmStopping_) {
+    LOG4CPLUS_INFO(log_,"shutdown 'shm' workloop, "<<shm_.nbFramesSent()
+		   <<" frames sent, "<<shm_.nbFramesReceived()<<" received.");
+    isShmPolling_=false;
+    return false;
+  }
+  
+  // the same messages as received by the i2o callbacks
+  unsigned int nbFrames=0;
+  while (nbFrames<64&&shm_.receive(shmFrame_)) {
+    nbFrames++;
+    if (isHalting_) continue;
+    unsigned int size=shmFrame_.size();
+    const I2O_PRIVATE_MESSAGE_FRAME* pvtMsg=
+      (const I2O_PRIVATE_MESSAGE_FRAME*)&shmFrame_[0];
+    if (size<sizeof(I2O_PRIVATE_MESSAGE_FRAME)) {
+      LOG4CPLUS_WARN(log_,"Ignore shm frame of "<<size<<" bytes.");
+      continue;
+    }
+    if (pvtMsg->XFunctionCode==I2O_BU_ALLOCATE) {
+      const I2O_BU_ALLOCATE_MESSAGE_FRAME* msg=
+	(const I2O_BU_ALLOCATE_MESSAGE_FRAME*)pvtMsg;
+      if (size<sizeof(*msg)||
+	  (msg->n>0&&size<sizeof(*msg)+(msg->n-1)*sizeof(msg->allocate[0])))
+	LOG4CPLUS_WARN(log_,"Ignore truncated BU_ALLOCATE shm frame.");
+      else allocateFrame(msg);
+    }
+    else if (pvtMsg->XFunctionCode==I2O_BU_DISCARD) {
+      const I2O_BU_DISCARD_MESSAGE_FRAME* msg=
+	(const I2O_BU_DISCARD_MESSAGE_FRAME*)pvtMsg;
+      if (size<sizeof(*msg))
+	LOG4CPLUS_WARN(log_,"Ignore truncated BU_DISCARD shm frame.");
+      else discardFrame(msg);
+    }
+    else
+      LOG4CPLUS_WARN(log_,"Ignore shm frame with XFunctionCode "
+		     <<pvtMsg->XFunctionCode);
+  }
+  if (0==nbFrames) ::usleep(shmPollUs_.value_);
+  return true;
+}
+
+
+//______________________________________________________________________________
+void BU::stopShm()
+{
+  if (isShmPolling_) {
+    isShmStopping_=true;
+    while (isShmPolling_) ::usleep(10000);
+  }
+  shm_.close();
+  isShm_=false;
+}
+
+
+//______________________________________________________________________________
+void BU::startReplayingWorkLoop() throw (evf::Exception)
+{
+  lock();
+  isTraceDone_=false;
+  while (!traceSentIds_.empty()) traceSentIds_.pop();
+  tracePendingDiscards_=0;
+  unlock();
+  sem_init(&traceStopSem_,0,0);
+  gettimeofday(&traceStart_,0);
+  
+  try {
+    LOG4CPLUS_INFO(log_,"Start 'replaying' workloop, FU trace "
+		   <<fuTraceFile_.toString());
+    wlReplaying_=toolbox::task::getWorkLoopFactory()->getWorkLoop(sourceId_+
+								  "Replaying",
+								  "waiting");
+    if (!wlReplaying_->isActive()) wlReplaying_->activate();
+    
+    asReplaying_=toolbox::task::bind(this,&BU::replaying,sourceId_+"Replaying");
+    wlReplaying_->submit(asReplaying_);
+    isReplaying_=true;
+  }
+  catch (xcept::Exception& e) {
+    string msg = "Failed to start workloop 'replaying'.";
+    XCEPT_RETHROW(evf::Exception,msg,e);
+  }
+}
+
+
+//______________________________________________________________________________
+bool BU::replaying(toolbox::task::WorkLoop* wl)
+{
+  placeThread("replaying");
+  
+  FUTrace::Record record;
+  if (!fuTrace_.next(record)) {
+    LOG4CPLUS_INFO(log_,"FU trace replayed, "<<fuTrace_.nbRecords()<<" records.");
+    finishTrace();
+    isReplaying_=false;
+    return false;
+  }
+  
+  // wait for the time of the record, or to be stopped
+  struct timespec deadline;
+  uint64_t usec=traceStart_.tv_usec+record.timeUs;
+  deadline.tv_sec =traceStart_.tv_sec+usec/1000000;
+  deadline.tv_nsec=(usec%1000000)*1000;
+  int result;
+  while ((result=sem_timedwait(&traceStopSem_,&deadline))!=0&&errno==EINTR);
+  if (0==result) {
+    LOG4CPLUS_INFO(log_,"shutdown 'replaying' workloop, "
+		   <<fuTrace_.nbRecords()<<" records replayed.");
+    finishTrace();
+    isReplaying_=false;
+    return false;
+  }
+  
+  if (record.type==FUTrace::ALLOCATE)
+    for (unsigned int i=0;i<record.ids.size();i++) allocate(record.ids[i]);
+  else if (record.type==FUTrace::DISCARD)
+    for (unsigned int i=0;i<record.ids.size();i++) discardOldest();
+  return true;
+}
+
+
+//______________________________________________________________________________
+void BU::stopReplaying()
+{
+  if (!isReplaying_) return;
+  sem_post(&traceStopSem_);
+  while (isReplaying_) ::usleep(10000);
+}
+
+
+//______________________________________________________________________________
+void BU::startValidatingWorkLoop() throw (evf::Exception)
+{
+  // validatePrescale may change while running, the sender uses this copy
+  validateEvery_=std::max(1U,validatePrescale_.value_);
+  validator_.start(validateCrc_.value_);
+  
+  try {
+    LOG4CPLUS_INFO(log_,"Start 'validating' workloop, checking every "
+		   <<validateEvery_<<". chain");
+    wlValidating_=toolbox::task::getWorkLoopFactory()->getWorkLoop(sourceId_+
+								   "Validating",
+								   "waiting");
+    if (!wlValidating_->isActive()) wlValidating_->activate();
+    
+    asValidating_=toolbox::task::bind(this,&BU::validating,
+				      sourceId_+"Validating");
+    wlValidating_->submit(asValidating_);
+    isValidating_=true;
+  }
+  catch (xcept::Exception& e) {
+    string msg = "Failed to start workloop 'validating'.";
+    XCEPT_RETHROW(evf::Exception,msg,e);
+  }
+}
+
+
+//______________________________________________________________________________
+bool BU::validating(toolbox::task::WorkLoop* wl)
+{
+  placeThread("validating");
+  uint64_t nbErrors=validator_.nbErrors();
+  
+  if (!validator_.validate()) {
+    LOG4CPLUS_INFO(log_,"shutdown 'validating' workloop, "
+		   <<validator_.nbValidated()<<" chains validated, "
+		   <<validator_.nbErrors()<<" errors.");
+    isValidating_=false;
+    return false;
+  }
+  
+  if (validator_.nbErrors()>nbErrors)
+    LOG4CPLUS_ERROR(log_,"invalid i2o chain: "<<validator_.lastError());
+  return true;
+}
+
+
+//______________________________________________________________________________
+void BU::stopValidating()
+{
+  if (!isValidating_) return;
+  validator_.stop();
+  while (isValidating_) ::usleep(10000);
+}
+
+
+//______________________________________________________________________________
+void BU::startSerializingWorkLoops() throw (evf::Exception)
+{
+  isSerializeStopping_=false;
+  while (wlSerializing_.size()<nbSerializers_.value_) {
+    ostringstream oss; oss<<sourceId_<<"Serializing"<<wlSerializing_.size();
+    try {
+      LOG4CPLUS_INFO(log_,"Start '"<<oss.str()<<"' workloop");
+      toolbox::task::WorkLoop *wl=
+	toolbox::task::getWorkLoopFactory()->getWorkLoop(oss.str(),"waiting");
+      if (!wl->isActive()) wl->activate();
+      toolbox::task::ActionSignature *as=
+	toolbox::task::bind(this,&BU::serializing,oss.str());
+      wlSerializing_.push_back(wl);
+      asSerializing_.push_back(as);
+      __sync_fetch_and_add(&nbSerializersRunning_,1);
+      wl->submit(as);
+    }
+    catch (xcept::Exception& e) {
+      string msg = "Failed to start workloop '"+oss.str()+"'.";
+      XCEPT_RETHROW(evf::Exception,msg,e);
+    }
+  }
+  nbSerializersActive_=std::min((unsigned int)wlSerializing_.size(),
+				nbSerializers_.value_);
+}
+
+
+//______________________________________________________________________________
+bool BU::serializing(toolbox::task::WorkLoop* wl)
+{
+  // the threads are numbered as they start, the workloop thread may be
+  // reused when the pool is started again
+  if (serializerIndex<0)
+    serializerIndex=__sync_fetch_and_add(&nbSerializersIndexed_,1);
+  placeThread("serializing",serializerIndex);
+  sem_wait(&serializeSem_);
+  if (isSerializeStopping_) {
+    LOG4CPLUS_INFO(log_,"shutdown 'serializing' workloop.");
+    serializerIndex=-1;
+    threadPlacementVersion=0;
+    threadPlacementVersion=0;
+    __sync_fetch_and_sub(&nbSerializersRunning_,1);
+    return false;
+  }
+  serializeSuperFrags();
+  sem_post(&serializeDoneSem_);
+  return true;
+}
+
+
+//______________________________________________________________________________
+void BU::stopSerializing()
+{
+  if (wlSerializing_.empty()) return;
+  
+  // wait for the event being serialized, whose helpers consume their posts
+  sem_wait(&serializeMutex_);
+  isSerializeStopping_=true;
+  __sync_synchronize();
+  for (unsigned int i=0;i<wlSerializing_.size();i++) sem_post(&serializeSem_);
+  while (nbSerializersRunning_>0) ::usleep(10000);
+  nbSerializersIndexed_=0;
+  wlSerializing_.clear();
+  asSerializing_.clear();
+  nbSerializersActive_=0;
+  sem_post(&serializeMutex_);
+}
+
+
+//______________________________________________________________________________
+void BU::startMonitoringWorkLoop() throw (evf::Exception)
+{
+  struct timezone timezone;
+  gettimeofday(&monStartTime_,&timezone);
+  
+  try {
+    LOG4CPLUS_INFO(log_,"Start 'monitoring' workloop");
+    wlMonitoring_=
+      toolbox::task::getWorkLoopFactory()->getWorkLoop(sourceId_+
+						       "Monitoring",
+						       "waiting");
+    if (!wlMonitoring_->isActive()) wlMonitoring_->activate();
+    asMonitoring_=toolbox::task::bind(this,&BU::monitoring,sourceId_+"Monitoring");
+    wlMonitoring_->submit(asMonitoring_);
+  }
+  catch (xcept::Exception& e) {
+    string msg = "Failed to start workloop 'monitoring'.";
+    XCEPT_RETHROW(evf::Exception,msg,e);
+  }
+}
+
+
+//______________________________________________________________________________
+bool BU::monitoring(toolbox::task::WorkLoop* wl)
+{
+  placeThread("monitoring");
+  struct timeval  monEndTime;
+  struct timezone timezone;
+  
+  gettimeofday(&monEndTime,&timezone);
+  
+  lock();
+  unsigned int monN           =nbEventsBuilt_.value_;
+  uint64_t     monSumOfSquares=sumOfSquares_;
+  unsigned int monSumOfSizes  =sumOfSizes_;
+  uint64_t     deltaSumOfSquares;
+  unlock();
+  
+  gui_->monInfoSpace()->lock();
+  
+  nbEventsSampled_.value_      =sampler_.nbSampled();
+  nbEventsSampleDropped_.value_=sampler_.nbDropped();
+  nbChainsValidated_.value_    =validator_.nbValidated();
+  nbChainErrors_.value_        =validator_.nbErrors();
+  if (nbChainErrors_.value_>0) lastChainError_=validator_.lastError();
+  nbWaitImmediate_.value_=
+    buildWait_.nbImmediate()+sendWait_.nbImmediate()+rqstWait_.nbImmediate();
+  nbWaitSpins_.value_ =buildWait_.nbSpins() +sendWait_.nbSpins() +rqstWait_.nbSpins();
+  nbWaitYields_.value_=buildWait_.nbYields()+sendWait_.nbYields()+rqstWait_.nbYields();
+  nbWaitSleeps_.value_=buildWait_.nbSleeps()+sendWait_.nbSleeps()+rqstWait_.nbSleeps();
+  nbTraceRecords_.value_=fuTrace_.nbRecords();
+  lock();
+  if (!evtClassCounts_.empty()) {
+    ostringstream info;
+    for (unsigned int i=0;i<evtClassCounts_.size();i++)
+      info<<(i>0 ? " " : "")<<evtClassNames_[i]<<":"<<evtClassCounts_[i];
+    eventClassInfo_=info.str();
+  }
+  unlock();
+  
+  lock();
+  sendLatencyAvgUs_=(sendLatencyN_>0) ? sendLatencySumUs_/sendLatencyN_ : 0.0;
+  sendLatencyPeakUs_=sendLatencyMaxUs_;
+  eventsPerPost_   =(nbPosts_>0) ? (double)sendLatencyN_/nbPosts_ : 0.0;
+  sendLatencySumUs_=0.0;
+  sendLatencyMaxUs_=0.0;
+  sendLatencyN_    =0;
+  nbPosts_         =0;
+  unlock();
+  
+  deltaT_.value_=deltaT(&monStartTime_,&monEndTime);
+  monStartTime_=monEndTime;
+  
+  deltaN_.value_=monN-monLastN_;
+  monLastN_=monN;
+
+  deltaSumOfSquares=monSumOfSquares-monLastSumOfSquares_;
+  deltaSumOfSquares_.value_=(double)deltaSumOfSquares;
+  monLastSumOfSquares_=monSumOfSquares;
+  
+  deltaSumOfSizes_.value_=monSumOfSizes-monLastSumOfSizes_;
+  monLastSumOfSizes_=monSumOfSizes;
+  
+  if (deltaT_.value_!=0) {
+    throughput_=deltaSumOfSizes_.value_/deltaT_.value_;
+    rate_      =deltaN_.value_/deltaT_.value_;
+  }
+  else {
+    throughput_=0.0;
+    rate_      =0.0;
+  }
+  
+  double meanOfSquares,mean,squareOfMean,variance;
+  
+  if(deltaN_.value_!=0) {
+    meanOfSquares=deltaSumOfSquares_.value_/((double)(deltaN_.value_));
+    mean=((double)(deltaSumOfSizes_.value_))/((double)(deltaN_.value_));
+    squareOfMean=mean*mean;
+    variance=meanOfSquares-squareOfMean;
+    average_=deltaSumOfSizes_.value_/deltaN_.value_;
+    rms_    =std::sqrt(variance);
+  }
+  else {
+    average_=0.0;
+    rms_    =0.0;
+  }
+
+  if (adaptiveDepth_.value_) adaptDepth(deltaT_.value_);
+  
+  // history of the intervals, which also drives the scan
+  MonitorHistory::Entry entry;
+  uint64_t bins[LatencyHistogram::nBins],sumUs,count=0;
+  discardLatencyHist_.read(bins,sumUs);
+  for (unsigned int i=0;i<LatencyHistogram::nBins;i++) count+=bins[i];
+  entry.time            =monEndTime.tv_sec+monEndTime.tv_usec*1e-6;
+  entry.deltaT          =deltaT_.value_;
+  entry.rate            =rate_.value_;
+  entry.throughput      =throughput_.value_;
+  entry.average         =average_.value_;
+  entry.rms             =rms_.value_;
+  entry.sendLatencyUs   =sendLatencyAvgUs_.value_;
+  entry.discardLatencyUs=(count>histLastCount_) ?
+    (double)(sumUs-histLastSumUs_)/(count-histLastCount_) : 0.0;
+  entry.fedSizeMean     =fedSizeMean_.value_;
+  entry.activeDepth     =activeDepth_.value_;
+  histLastCount_=count;
+  histLastSumUs_=sumUs;
+  history_.add(entry);
+  if (scan_.isActive()&&scan_.update(entry)) applyScanStep();
+  
+  for (unsigned int i=0;i<StageCounters::N_STAGES;i++) {
+    StageCounters::Totals totals;
+    stageCounters_.delta((StageCounters::Stage)i,totals);
+    if (totals.n>0)
+      stageCosts_[i]=StageCounters::format(totals);
+  }
+  
+  gui_->monInfoSpace()->unlock();
+  
+  if (discardTimeoutSec_.value_>0) reclaimSlots();
+  
+  publishMetrics();
+  
+  ::sleep(monSleepSec_.value_);
+
+  return true;
+}
+    
+
+
+////////////////////////////////////////////////////////////////////////////////
+// implementation of private member functions
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+void BU::placeThread(const char* name,int index)
+{
+  if (threadPlacementVersion==placementVersion_) return;
+  threadPlacementVersion=placementVersion_;
+  
+  // threads of a pool (index>=0) are placed one by one
+  ostringstream key; key<<name;
+  if (index>=0) key<<index;
+  
+  string result=placement_.apply(name,index);
+  if (result.empty()) return;
+  LOG4CPLUS_INFO(log_,"'"<<key.str()<<"' workloop placed on "<<result);
+  
+  gui_->monInfoSpace()->lock();
+  placedThreads_[key.str()]=result;
+  ostringstream info;
+  map<string,string>::const_iterator it;
+  for (it=placedThreads_.begin();it!=placedThreads_.end();++it) {
+    if (it!=placedThreads_.begin()) info<<"; ";
+    info<<it->first<<": "<<it->second;
+  }
+  placementInfo_=info.str();
+  gui_->monInfoSpace()->unlock();
+}
+
+
+//______________________________________________________________________________
+void BU::reclaimSlots()
+{
+  struct timeval now;
+  gettimeofday(&now,0);
+  double timeout=discardTimeoutSec_.value_;
+  
+  vector<unsigned int> reclaimed;
+  unsigned int nbFreed=0;
+  
+  lock();
+  if (sentTimes_.size()!=events_.size()) { unlock(); return; }
+  set<unsigned int>::iterator it=sentIds_.begin();
+  while (it!=sentIds_.end()) {
+    if (deltaT(&sentTimes_[*it],&now)>timeout) {
+      reclaimed.push_back(*it);
+      reclaimedIds_[*it]=now;
+      sentIds_.erase(it++);
+    }
+    else ++it;
+  }
+  map<unsigned int,struct timeval>::iterator itr=reclaimedIds_.begin();
+  while (itr!=reclaimedIds_.end()) {
+    if (deltaT(&itr->second,&now)>timeout) {
+      if (releaseSlot(itr->first)) nbFreed++;
+      reclaimedIds_.erase(itr++);
+    }
+    else ++itr;
+  }
+  nbSlotsReclaimed_.value_+=reclaimed.size();
+  unlock();
+  
+  for (unsigned int i=0;i<reclaimed.size();i++)
+    LOG4CPLUS_WARN(log_,"buResourceId '"<<reclaimed[i]<<"' not discarded after "
+		   <<discardTimeoutSec_.value_<<" sec, reclaimed.");
+  for (unsigned int i=0;i<nbFreed;i++) postBuild();
+}
+
+
+//______________________________________________________________________________
+bool BU::releaseSlot(unsigned int buResourceId)
+{
+  // called with the lock held: a slot beyond the active depth is parked
+  // instead of given to the builder (false)
+  if (nbActiveSlots_>activeDepth_.value_) {
+    parkedIds_.push_back(buResourceId);
+    nbActiveSlots_--;
+    return false;
+  }
+  freeIds_.push(buResourceId);
+  return true;
+}
+
+
+//______________________________________________________________________________
+void BU::adaptDepth(double deltaT)
+{
+  if (deltaT<=0.0) return;
+  
+  lock();
+  unsigned int nbRqst=nbEventsRequested_.value_-depthLastRqst_;
+  depthLastRqst_     =nbEventsRequested_.value_;
+  unsigned int nbDiscards=discardLatencyN_;
+  double latency=(nbDiscards>0) ? discardLatencySum_/nbDiscards : 0.0;
+  discardLatencySum_=0.0;
+  discardLatencyN_  =0;
+  unlock();
+  
+  // smoothed over monitoring periods; no demand: keep the depth
+  double rate=nbRqst/deltaT;
+  rqstRateAvg_=(rqstRateAvg_>0.0) ? 0.5*(rqstRateAvg_+rate) : rate;
+  if (nbDiscards>0)
+    discardLatencyAvg_=(discardLatencyAvg_>0.0) ?
+      0.5*(discardLatencyAvg_+latency) : latency;
+  if (nbDiscards==0||rqstRateAvg_<=0.0) return;
+  
+  // Little's law: rate x latency slots are with the FU, keep 'margin'
+  // times as many in flight, plus the one being built
+  unsigned int depthMax=queueSize_.value_;
+  unsigned int depthMin=std::min(depthMin_.value_,depthMax);
+  double       target  =depthMargin_.value_*rqstRateAvg_*discardLatencyAvg_+1.0;
+  unsigned int depth   =(target>=depthMax) ? depthMax : (unsigned int)std::ceil(target);
+  if (depth<depthMin) depth=depthMin;
+  
+  // don't follow fluctuations of less than an eighth
+  unsigned int current=activeDepth_.value_;
+  unsigned int delta  =(depth>current) ? depth-current : current-depth;
+  if (0==delta||delta<current/8) return;
+  
+  ostringstream reason;
+  reason<<((depth>current) ? "grow " : "shrink ")<<current<<" -> "<<depth<<": "
+	<<(unsigned int)rqstRateAvg_<<" Hz requests x "
+	<<discardLatencyAvg_*1e3<<" ms send-to-discard x margin "
+	<<depthMargin_.value_;
+  
+  // slots are parked when they come back, and unparked right away
+  unsigned int nbUnparked=0;
+  lock();
+  activeDepth_.value_=depth;
+  while (nbActiveSlots_<depth&&!parkedIds_.empty()) {
+    freeIds_.push(parkedIds_.back());
+    parkedIds_.pop_back();
+    nbActiveSlots_++;
+    nbUnparked++;
+  }
+  unlock();
+  
+  depthChangeReason_=reason.str();
+  LOG4CPLUS_INFO(log_,"in-flight depth: "<<reason.str());
+  for (unsigned int i=0;i<nbUnparked;i++) postBuild();
+}
+
+
+//______________________________________________________________________________
+void BU::publishMetrics()
+{
+  typedef MetricsSnapshot M;
+  M::Data data;
+  struct timeval now;
+  gettimeofday(&now,0);
+  data.timestamp=now.tv_sec+now.tv_usec*1e-6;
+  
+  lock();
+  data.values[M::NB_EVTS_IN_BU]     =nbEventsInBU_.value_;
+  data.values[M::NB_EVTS_REQUESTED] =nbEventsRequested_.value_;
+  data.values[M::NB_EVTS_BUILT]     =nbEventsBuilt_.value_;
+  data.values[M::NB_EVTS_SENT]      =nbEventsSent_.value_;
+  data.values[M::NB_EVTS_DISCARDED] =nbEventsDiscarded_.value_;
+  data.values[M::NB_SLOTS_RECLAIMED]=nbSlotsReclaimed_.value_;
+  data.values[M::NB_LATE_DISCARDS]  =nbLateDiscards_.value_;
+  data.values[M::FREE_SLOTS]        =freeIds_.size();
+  data.values[M::BUILT_SLOTS]       =builtIds_.size();
+  data.values[M::SENT_SLOTS]        =sentIds_.size();
+  data.values[M::PENDING_REQUESTS]  =rqstIds_.size();
+  data.values[M::PARKED_SLOTS]      =parkedIds_.size();
+  data.values[M::ACTIVE_DEPTH]      =activeDepth_.value_;
+  unlock();
+  
+  data.values[M::NB_CHAIN_ERRORS]   =nbChainErrors_.value_;
+  data.values[M::RATE]              =rate_.value_;
+  data.values[M::THROUGHPUT]        =throughput_.value_;
+  data.values[M::AVERAGE]           =average_.value_;
+  data.values[M::RMS]               =rms_.value_;
+  data.values[M::EVENT_MEM]         =eventPool_.used()*9.53674e-07;
+  data.values[M::EVENT_MEM_PEAK]    =eventPool_.peakUsed()*9.53674e-07;
+  data.values[M::REPLAY_CACHE_MEM]  =replayCache_.compressedSize()*9.53674e-07;
+  data.values[M::SEND_LATENCY_AVG]  =sendLatencyAvgUs_.value_;
+  data.values[M::SEND_LATENCY_PEAK] =sendLatencyPeakUs_.value_;
+  data.values[M::EVENTS_PER_POST]   =eventsPerPost_.value_;
+  sendLatencyHist_.read(data.sendLatency,data.sendLatencySumUs);
+  discardLatencyHist_.read(data.discardLatency,data.discardLatencySumUs);
+  
+  metrics_.publish(data);
+}
+
+
+//______________________________________________________________________________
+bool BU::publishGeneratorConfig(string& error)
+{
+  GeneratorConfig::Settings gen;
+  gen.fedSizeMean =fedSizeMean_.value_;
+  gen.fedSizeWidth=fedSizeWidth_.value_;
+  gen.fedSizeMax  =fedSizeMax_.value_;
+  gen.fixedFedSize=useFixedFedSize_.value_;
+  gen.crc         =crc_.value_;
+  gen.targetRate  =(scanRate_>0.0) ? scanRate_ : targetRate_.value_;
+  if (!GeneratorConfig::complete(gen,error)) return false;
+  if (!gen.eventClasses.configure(eventClasses_.value_,error)) {
+    error="invalid eventClasses: "+error;
+    return false;
+  }
+  // valid fed ids are only known once enabled
+  for (unsigned int i=0;i<gen.eventClasses.size()&&!validFedIds_.empty();i++) {
+    unsigned int nFed=0;
+    for (unsigned int j=0;j<validFedIds_.size();j++)
+      if (gen.eventClasses[i].feds[validFedIds_[j]]) nFed++;
+    if (nFed==0) {
+      error="no valid fed in event class '"+gen.eventClasses[i].name+"'";
+      return false;
+    }
+  }
+  genConfig_.publish(gen);
+  return true;
+}
+
+
+//______________________________________________________________________________
+void BU::useGeneratorConfig(const GeneratorConfig::Settings& gen)
+{
+  // called by the builder, which is the only one to fill evtClassCounts_
+  genVersion_=gen.version;
+  buildRate_ =gen.targetRate;
+  BUEvent::setComputeCrc(gen.crc);
+  
+  vector<string> names;
+  for (unsigned int i=0;i<gen.eventClasses.size();i++)
+    names.push_back(gen.eventClasses[i].name);
+  if (names!=evtClassNames_) {
+    lock();
+    evtClassNames_.swap(names);
+    evtClassCounts_.assign(evtClassNames_.size(),0);
+    unlock();
+  }
+}
+
+
+//______________________________________________________________________________
+void BU::paceBuilding()
+{
+  // absolute deadlines, without catching up after stalls of more than 1s
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  double now=ts.tv_sec+ts.tv_nsec*1e-9;
+  if (nextBuildTime_<now-1.0) nextBuildTime_=now;
+  if (nextBuildTime_>now) {
+    ts.tv_sec =(time_t)nextBuildTime_;
+    ts.tv_nsec=(long)((nextBuildTime_-ts.tv_sec)*1e9);
+    clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&ts,0);
+  }
+  nextBuildTime_+=1.0/buildRate_;
+}
+
+
+//______________________________________________________________________________
+void BU::startScan()
+{
+  scanFedSizeMean_ =fedSizeMean_.value_;
+  scanFedSizeWidth_=fedSizeWidth_.value_;
+  scan_.start();
+  applyScanStep();
+}
+
+
+//______________________________________________________________________________
+void BU::applyScanStep()
+{
+  ostringstream status;
+  string error;
+  if (!scan_.isActive()) {
+    fedSizeMean_ =scanFedSizeMean_;
+    fedSizeWidth_=scanFedSizeWidth_;
+    scanRate_    =0.0;
+    if (!publishGeneratorConfig(error))
+      LOG4CPLUS_ERROR(log_,"Failed to restore the generator parameters: "<<error);
+    vector<LoadScan::Result> results;
+    scan_.results(results);
+    ostringstream table;
+    LoadScan::writeTable(table,results);
+    LOG4CPLUS_INFO(log_,"scan finished after "<<results.size()<<" of "
+		   <<scan_.nSteps()<<" steps:\n"<<table.str());
+    status<<"finished, "<<results.size()<<" of "<<scan_.nSteps()<<" steps";
+    scanStatus_=status.str();
+    return;
+  }
+  
+  // the width scales with the fed size
+  const LoadScan::Step& step=scan_.step();
+  unsigned int fedSizeMean=(step.fedSize>0) ? step.fedSize : scanFedSizeMean_;
+  fedSizeMean_ =fedSizeMean;
+  fedSizeWidth_=(unsigned int)((double)scanFedSizeWidth_*fedSizeMean/scanFedSizeMean_);
+  scanRate_    =step.rate;
+  if (!publishGeneratorConfig(error))
+    LOG4CPLUS_ERROR(log_,"Invalid scan step: "<<error);
+  
+  status<<"step "<<scan_.iStep()+1<<" of "<<scan_.nSteps()<<": fedSize "
+	<<fedSizeMean_.value_<<", rate "
+	<<((scanRate_>0.0) ? scanRate_ : targetRate_.value_)<<" Hz";
+  scanStatus_=status.str();
+  LOG4CPLUS_INFO(log_,"scan "<<status.str());
+}
+
+
+//______________________________________________________________________________
+void BU::allocate(unsigned int fuResourceId)
+{
+  lock();
+  rqstIds_.push(fuResourceId);
+  postRqst();
+  nbEventsRequested_++;
+  nbEventsInBU_++;
+  unlock();
+}
+
+
+//______________________________________________________________________________
+bool BU::discard(unsigned int buResourceId)
+{
+  struct timeval now;
+  gettimeofday(&now,0);
+  
+  lock();
+  int result=sentIds_.erase(buResourceId);
+  int late  =(result) ? 0 : reclaimedIds_.erase(buResourceId);
+  bool free =(result||late)&&releaseSlot(buResourceId);
+  if (result) {
+    double latency=deltaT(&sentTimes_[buResourceId],&now);
+    discardLatencyHist_.add(latency*1e6);
+    discardLatencySum_+=latency;
+    discardLatencyN_++;
+  }
+  if (result) nbEventsDiscarded_.value_++;
+  if (late)   nbLateDiscards_.value_++;
+  if (!result&&!late) nbDuplicateDiscards_.value_++;
+  unlock();
+  
+  if (late) {
+    LOG4CPLUS_WARN(log_,"late discard of reclaimed buResourceId '"<<buResourceId<<"'");
+  }
+  else if (!result) {
+    LOG4CPLUS_ERROR(log_,"can't discard unknown buResourceId '"<<buResourceId<<"'");
+    return false;
+  }
+  if (free) postBuild();
+  return true;
+}
+
+
+//______________________________________________________________________________
+void BU::allocateFrame(const I2O_BU_ALLOCATE_MESSAGE_FRAME* msg)
+{
+  if (fuTrace_.isRecording()) {
+    vector<unsigned int> ids(msg->n);
+    for (unsigned int i=0;i<msg->n;i++) ids[i]=msg->allocate[i].fuTransactionId;
+    if (!ids.empty()) fuTrace_.record(FUTrace::ALLOCATE,&ids[0],ids.size());
+  }
+
+  StageCounters::Sample sample;
+  bool sampled=stageCounters_.begin(sample);
+
+  for (unsigned int i=0;i<msg->n;i++)
+    allocate(msg->allocate[i].fuTransactionId);
+
+  if (sampled) stageCounters_.end(StageCounters::ALLOCATE,sample);
+}
+
+
+//______________________________________________________________________________
+void BU::discardFrame(const I2O_BU_DISCARD_MESSAGE_FRAME* msg)
+{
+  // only the first buResourceId is discarded, record just that one so
+  // that the replay applies the same discards
+  if (fuTrace_.isRecording())
+    fuTrace_.record(FUTrace::DISCARD,msg->buResourceId,1);
+
+  StageCounters::Sample sample;
+  bool sampled=stageCounters_.begin(sample);
+
+  discard(msg->buResourceId[0]);
+
+  if (sampled) stageCounters_.end(StageCounters::DISCARD,sample);
+}
+
+
+//______________________________________________________________________________
+void BU::postChain(toolbox::mem::Reference* msg)
+{
+  I2O_EVENT_DATA_BLOCK_MESSAGE_FRAME *block=
+    (I2O_EVENT_DATA_BLOCK_MESSAGE_FRAME*)msg->getDataLocation();
+  unsigned int buResourceId=block->buResourceId;
+  unsigned int fuResourceId=block->fuTransactionId;
+  
+  // collect the chains of several events and post them together
+  if (sendBatchSize_.value_>1&&traceMode_!=TRACE_REPLAY&&!loopback_.value_&&!isShm_) {
+    uint64_t nbBytes=0;
+    toolbox::mem::Reference* tail=msg;
+    for (;;) {
+      nbBytes+=tail->getDataSize();
+      if (0==tail->getNextReference()) break;
+      tail=tail->getNextReference();
+    }
+    if (0==batchHead_) {
+      struct timeval now;
+      gettimeofday(&now,0);
+      uint64_t usec=now.tv_usec+sendBatchDelayUs_.value_;
+      batchDeadline_.tv_sec =now.tv_sec+usec/1000000;
+      batchDeadline_.tv_nsec=(usec%1000000)*1000;
+      batchHead_=msg;
+    }
+    else batchTail_->setNextReference(msg);
+    batchTail_  =tail;
+    batchBytes_+=nbBytes;
+    batchIds_.push_back(buResourceId);
+    if (batchIds_.size()>=sendBatchSize_.value_||
+	(sendBatchBytes_.value_>0&&batchBytes_>=sendBatchBytes_.value_))
+      flushBatch();
+    return;
+  }
+  
+  recordSendLatency(&buResourceId,1);
+  
+  // the trace decides when the event is discarded, unless it is over
+  if (traceMode_==TRACE_REPLAY) {
+    msg->release();
+    
+    lock();
+    bool isDone   =isTraceDone_;
+    bool isPending=!isDone&&tracePendingDiscards_>0;
+    if (isPending) tracePendingDiscards_--;
+    if (!isDone&&!isPending)
+      traceSentIds_.push(make_pair(buResourceId,fuResourceId));
+    unlock();
+    
+    if (isDone||isPending) discard(buResourceId);
+    if (isDone) allocate(fuResourceId);
+    return;
+  }
+  
+  if (isShm_) {
+    postShm(msg);
+    return;
+  }
+  
+  if (!loopback_.value_) {
+    buAppContext_->postFrame(msg,buAppDesc_,fuAppDesc_);
+    return;
+  }
+  
+  LoopbackChain chain;
+  chain.msg=msg;
+  gettimeofday(&chain.due,0);
+  chain.due.tv_usec+=loopbackDelayUs_.value_;
+  chain.due.tv_sec +=chain.due.tv_usec/1000000;
+  chain.due.tv_usec%=1000000;
+  lock();
+  loopbackChains_.push(chain);
+  unlock();
+  sem_post(&loopbackSem_);
+}
+
+
+//______________________________________________________________________________
+void BU::postShm(toolbox::mem::Reference* msg)
+{
+  // the FU gives back ring space as it takes the frames
+  ShmTransport::Status status;
+  while (ShmTransport::FULL==(status=shm_.send(msg))&&!isHalting_) {
+    nbShmFullWaits_.value_++;
+    ::usleep(shmPollUs_.value_);
+  }
+  if (ShmTransport::TOO_LARGE==status) {
+    I2O_EVENT_DATA_BLOCK_MESSAGE_FRAME *block=
+      (I2O_EVENT_DATA_BLOCK_MESSAGE_FRAME*)msg->getDataLocation();
+    LOG4CPLUS_ERROR(log_,"Event "<<block->eventNumber<<" doesn't fit into "
+		    "the shm ring, increase shmSizeMB.");
+    discard(block->buResourceId);
+  }
+  msg->release();
+}
+
+
+//______________________________________________________________________________
+void BU::flushBatch()
+{
+  if (0==batchHead_) return;
+  
+  // once posted, the FU may discard the slots and the builder reuse them
+  if (isHalting_) batchHead_->release();
+  else {
+    recordSendLatency(&batchIds_[0],batchIds_.size());
+    buAppContext_->postFrame(batchHead_,buAppDesc_,fuAppDesc_);
+  }
+  
+  batchHead_ =0;
+  batchTail_ =0;
+  batchBytes_=0;
+  batchIds_.clear();
+}
+
+
+//______________________________________________________________________________
+void BU::recordSendLatency(const unsigned int* buResourceIds,unsigned int n)
+{
+  struct timeval now;
+  gettimeofday(&now,0);
+  
+  lock();
+  for (unsigned int i=0;i<n;i++) {
+    double latency=deltaT(&builtTimes_[buResourceIds[i]],&now)*1e6;
+    sendLatencyHist_.add(latency);
+    sendLatencySumUs_+=latency;
+    if (latency>sendLatencyMaxUs_) sendLatencyMaxUs_=latency;
+  }
+  sendLatencyN_+=n;
+  nbPosts_++;
+  unlock();
+}
+
+
+//______________________________________________________________________________
+void BU::discardOldest()
+{
+  // the buResourceIds of the trace don't match, discard in sending order;
+  // if the BU is behind the trace, discard the next event sent
+  lock();
+  if (traceSentIds_.empty()) {
+    tracePendingDiscards_++;
+    unlock();
+    return;
+  }
+  unsigned int buResourceId=traceSentIds_.front().first; traceSentIds_.pop();
+  unlock();
+  discard(buResourceId);
+}
+
+
+//______________________________________________________________________________
+void BU::finishTrace()
+{
+  // from now on, discard each event when sent and give the credit back,
+  // keeping at least one credit so that the sender can drain
+  vector<pair<unsigned int,unsigned int> > sentIds;
+  lock();
+  isTraceDone_=true;
+  while (!traceSentIds_.empty()) {
+    sentIds.push_back(traceSentIds_.front());
+    traceSentIds_.pop();
+  }
+  tracePendingDiscards_=0;
+  bool noCredit=rqstIds_.empty()&&sentIds.empty();
+  unlock();
+  for (unsigned int i=0;i<sentIds.size();i++) {
+    discard(sentIds[i].first);
+    allocate(sentIds[i].second);
+  }
+  if (noCredit) allocate(0);
+}
+
+
+//______________________________________________________________________________
+void BU::exportParameters()
+{
+  if (0==gui_) {
+    LOG4CPLUS_ERROR(log_,"No GUI, can't export parameters");
+    return;
+  }
+  
+  gui_->addMonitorParam("url",                &url_);
+  gui_->addMonitorParam("class",              &class_);
+  gui_->addMonitorParam("instance",           &instance_);
+  gui_->addMonitorParam("hostname",           &hostname_);
+  gui_->addMonitorParam("runNumber",          &runNumber_);
+  gui_->addMonitorParam("stateName",          fsm_.stateName());
+  gui_->addMonitorParam("memUsedInMB",        &memUsedInMB_);
+  gui_->addMonitorParam("eventMemInMB",       &eventMemInMB_);
+  gui_->addMonitorParam("eventMemPeakInMB",   &eventMemPeakInMB_);
+  gui_->addMonitorParam("replayCacheInMB",    &replayCacheInMB_);
+  gui_->addMonitorParam("lastChainError",     &lastChainError_);
+  gui_->addMonitorParam("placement",          &placementInfo_);
+  gui_->addMonitorParam("eventClasses",       &eventClassInfo_);
+  gui_->addMonitorParam("activeDepth",        &activeDepth_);
+  gui_->addMonitorParam("depthChangeReason",  &depthChangeReason_);
+  gui_->addMonitorParam("scanStatus",         &scanStatus_);
+  for (unsigned int i=0;i<StageCounters::N_STAGES;i++) {
+    StageCounters::Stage stage=(StageCounters::Stage)i;
+    gui_->addMonitorParam(string(StageCounters::stageName(stage))+"Cost",
+			  &stageCosts_[i]);
+  }
+  gui_->addMonitorParam("deltaT",             &deltaT_);
+  gui_->addMonitorParam("deltaN",             &deltaN_);
+  gui_->addMonitorParam("deltaSumOfSquares",  &deltaSumOfSquares_);
+  gui_->addMonitorParam("deltaSumOfSizes",    &deltaSumOfSizes_);
+  gui_->addMonitorParam("throughput",         &throughput_);
+  gui_->addMonitorParam("average",            &average_);
+  gui_->addMonitorParam("rate",               &rate_);
+  gui_->addMonitorParam("rms",                &rms_);
+  gui_->addMonitorParam("sendLatencyAvgUs",   &sendLatencyAvgUs_);
+  gui_->addMonitorParam("sendLatencyPeakUs",  &sendLatencyPeakUs_);
+  gui_->addMonitorParam("eventsPerPost",      &eventsPerPost_);
+
+  gui_->addMonitorCounter("nbEvtsInBU",       &nbEventsInBU_);
+  gui_->addMonitorCounter("nbEvtsRequested",  &nbEventsRequested_);
+  gui_->addMonitorCounter("nbEvtsBuilt",      &nbEventsBuilt_);
+  gui_->addMonitorCounter("nbEvtsSent",       &nbEventsSent_);
+  gui_->addMonitorCounter("nbEvtsDiscarded",  &nbEventsDiscarded_);
+  gui_->addMonitorCounter("nbEvtsSampled",    &nbEventsSampled_);
+  gui_->addMonitorCounter("nbEvtsSampleDropped",&nbEventsSampleDropped_);
+  gui_->addMonitorCounter("nbEvtsDropped",    &nbEventsDropped_);
+  gui_->addMonitorCounter("nbChainsValidated",&nbChainsValidated_);
+  gui_->addMonitorCounter("nbChainErrors",    &nbChainErrors_);
+  gui_->addMonitorCounter("nbWaitImmediate",  &nbWaitImmediate_);
+  gui_->addMonitorCounter("nbWaitSpins",      &nbWaitSpins_);
+  gui_->addMonitorCounter("nbWaitYields",     &nbWaitYields_);
+  gui_->addMonitorCounter("nbWaitSleeps",     &nbWaitSleeps_);
+  gui_->addMonitorCounter("nbSlotsReclaimed", &nbSlotsReclaimed_);
+  gui_->addMonitorCounter("nbLateDiscards",   &nbLateDiscards_);
+  gui_->addMonitorCounter("nbDuplicateDiscards",&nbDuplicateDiscards_);
+  gui_->addMonitorCounter("nbTraceRecords",   &nbTraceRecords_);
+  gui_->addMonitorCounter("nbShmFullWaits",   &nbShmFullWaits_);
+
+  gui_->addStandardParam("mode",              &mode_);
+  gui_->addStandardParam("replay",            &replay_);
+  gui_->addStandardParam("replayCacheSize",   &replayCacheSize_);
+  gui_->addStandardParam("overwriteEvtId",    &overwriteEvtId_);
+  gui_->addStandardParam("overwriteLsId",     &overwriteLsId_);
+  gui_->addStandardParam("fakeLsUpdateSecs",   &fakeLsUpdateSecs_);
+  gui_->addStandardParam("patchCrc",          &patchCrc_);
+  gui_->addStandardParam("crc",               &crc_);
+  gui_->addStandardParam("firstEvent",        &firstEvent_);
+  gui_->addStandardParam("queueSize",         &queueSize_);
+  gui_->addStandardParam("eventBufferSize",   &eventBufferSize_);
+  gui_->addStandardParam("eventChunkSize",    &eventChunkSize_);
+  gui_->addStandardParam("eventMemoryMaxInMB",&eventMemoryMaxInMB_);
+  gui_->addStandardParam("msgBufferSize",     &msgBufferSize_);
+  gui_->addStandardParam("fedSizeMax",        &fedSizeMax_);
+  gui_->addStandardParam("fedSizeMean",       &fedSizeMean_);
+  gui_->addStandardParam("fedSizeWidth",      &fedSizeWidth_);
+  gui_->addStandardParam("useFixedFedSize",   &useFixedFedSize_);
+  gui_->addStandardParam("payloadPattern",    &payloadPattern_);
+  gui_->addStandardParam("payloadOccupancy",  &payloadOccupancy_);
+  gui_->addStandardParam("eventClasses",      &eventClasses_);
+  gui_->addStandardParam("monSleepSec",       &monSleepSec_);
+  gui_->addStandardParam("superFragMode",     &superFragMode_);
+  gui_->addStandardParam("superFragTable",    &superFragTable_);
+  gui_->addStandardParam("nbSuperFrags",      &nbSuperFrags_);
+  gui_->addStandardParam("superFragCalibEvents",&superFragCalibEvents_);
+  gui_->addStandardParam("readAheadDepth",    &readAheadDepth_);
+  gui_->addStandardParam("samplePrescale",    &samplePrescale_);
+  gui_->addStandardParam("sampleMinSize",     &sampleMinSize_);
+  gui_->addStandardParam("sampleBufferSize",  &sampleBufferSize_);
+  gui_->addStandardParam("sampleDir",         &sampleDir_);
+  gui_->addStandardParam("validatePrescale",  &validatePrescale_);
+  gui_->addStandardParam("validateCrc",       &validateCrc_);
+  gui_->addStandardParam("threadPlacement",   &threadPlacement_);
+  gui_->addStandardParam("numaNode",          &numaNode_);
+  gui_->addStandardParam("waitStrategy",      &waitStrategy_);
+  gui_->addStandardParam("spinCount",         &spinCount_);
+  gui_->addStandardParam("yieldCount",        &yieldCount_);
+  gui_->addStandardParam("discardTimeoutSec", &discardTimeoutSec_);
+  gui_->addStandardParam("adaptiveDepth",     &adaptiveDepth_);
+  gui_->addStandardParam("depthMin",          &depthMin_);
+  gui_->addStandardParam("depthMargin",       &depthMargin_);
+  gui_->addStandardParam("perfPrescale",      &perfPrescale_);
+  gui_->addStandardParam("historySize",       &historySize_);
+  gui_->addStandardParam("targetRate",        &targetRate_);
+  gui_->addStandardParam("scanSchedule",      &scanSchedule_);
+  gui_->addStandardParam("scanMinStepSec",    &scanMinStepSec_);
+  gui_->addStandardParam("scanMaxStepSec",    &scanMaxStepSec_);
+  gui_->addStandardParam("scanSteadyIntervals",&scanSteadyIntervals_);
+  gui_->addStandardParam("scanTolerance",     &scanTolerance_);
+  gui_->addStandardParam("loopback",          &loopback_);
+  gui_->addStandardParam("loopbackDelayUs",   &loopbackDelayUs_);
+  gui_->addStandardParam("loopbackCredits",   &loopbackCredits_);
+  gui_->addStandardParam("shmName",           &shmName_);
+  gui_->addStandardParam("shmSizeMB",         &shmSizeMB_);
+  gui_->addStandardParam("shmPollUs",         &shmPollUs_);
+  gui_->addStandardParam("fuTraceMode",       &fuTraceMode_);
+  gui_->addStandardParam("fuTraceFile",       &fuTraceFile_);
+  gui_->addStandardParam("sendBatchSize",     &sendBatchSize_);
+  gui_->addStandardParam("sendBatchBytes",    &sendBatchBytes_);
+  gui_->addStandardParam("sendBatchDelayUs",  &sendBatchDelayUs_);
+  gui_->addStandardParam("nbSerializers",     &nbSerializers_);
+  gui_->addStandardParam("parallelSerializeMinSize",&parallelSerializeMinSize_);
+  gui_->addStandardParam("preSerialize",      &preSerialize_);
+  gui_->addStandardParam("ntCopyThreshold",   &ntCopyThreshold_);
+  gui_->addStandardParam("rcmsStateListener",     fsm_.rcmsStateListener());
+  gui_->addStandardParam("foundRcmsStateListener",fsm_.foundRcmsStateListener());
+
+  
+  gui_->exportParameters();
+
+  gui_->addItemChangedListener("crc",            this);
+  gui_->addItemChangedListener("fedSizeMax",     this);
+  gui_->addItemChangedListener("fedSizeMean",    this);
+  gui_->addItemChangedListener("fedSizeWidth",   this);
+  gui_->addItemChangedListener("useFixedFedSize",this);
+  gui_->addItemChangedListener("eventClasses",   this);
+  gui_->addItemChangedListener("targetRate",     this);
+  
+}
+
+
+//______________________________________________________________________________
+void BU::reset()
+{
+  gui_->resetCounters();
+  
+  deltaT_             =0.0;
+  deltaN_             =  0;
+  deltaSumOfSquares_  =  0;
+  deltaSumOfSizes_    =  0;
+  
+  throughput_         =0.0;
+  average_            =  0;
+  rate_               =  0;
+  rms_                =  0;
+
+  monLastN_           =  0;
+  monLastSumOfSquares_=  0;
+  monLastSumOfSizes_  =  0;
+  
+  while (events_.size()) {
+    delete events_.back();
+    events_.pop_back();
+  }
+  
+  while (!rqstIds_.empty())  rqstIds_.pop();
+  while (!freeIds_.empty())  freeIds_.pop();
+  while (!builtIds_.empty()) builtIds_.pop();
+  sentIds_.clear();
+  reclaimedIds_.clear();
+  while (!loopbackChains_.empty()) {
+    if (0!=loopbackChains_.front().msg) loopbackChains_.front().msg->release();
+    loopbackChains_.pop();
+  }
+  
+  // loopback and trace replay point fuTid_ to the BU itself, the FU is
+  // learned again from the first I2O_BU_ALLOCATE
+  fuAppDesc_=0;
+  fuTid_    =0;
+ 
+  // all slots are allocated, only activeDepth of them are in flight
+  activeDepth_=queueSize_.value_;
+  if (adaptiveDepth_.value_)
+    activeDepth_=std::min(depthMin_.value_,queueSize_.value_);
+  nbActiveSlots_=activeDepth_.value_;
+  parkedIds_.clear();
+  discardLatencySum_=0.0;
+  discardLatencyN_  =0;
+  depthLastRqst_    =nbEventsRequested_.value_;
+  rqstRateAvg_      =0.0;
+  discardLatencyAvg_=0.0;
+  depthChangeReason_="";
+  
+  sem_init(&lock_,0,1);
+  sem_init(&buildSem_,0,activeDepth_.value_);
+  sem_init(&sendSem_,0,0);
+  sem_init(&rqstSem_,0,0);
+  sem_init(&loopbackSem_,0,0);
+  buildWait_.resetCounters();
+  sendWait_.resetCounters();
+  rqstWait_.resetCounters();
+  
+  // event memory is shared by all slots, by default limited to the
+  // former fixed size of eventBufferSize per slot
+  uint64_t eventMemoryMax=(uint64_t)eventMemoryMaxInMB_.value_*0x100000;
+  if (0==eventMemoryMax)
+    eventMemoryMax=(uint64_t)queueSize_.value_*eventBufferSize_.value_;
+  if (eventPool_.nbNumaFailures()>0)
+    LOG4CPLUS_WARN(log_,"Failed to place "<<eventPool_.nbNumaFailures()
+		   <<" event memory chunks on numa node "<<eventPool_.numaNode());
+  eventPool_.configure(eventChunkSize_.value_,eventMemoryMax,numaNode_.value_);
+  
+  for (unsigned int i=0;i<queueSize_;i++) {
+    events_.push_back(new BUEvent(i,&eventPool_));
+    if (i<activeDepth_.value_) freeIds_.push(i);
+    else parkedIds_.push_back(i);
+  }
+  sentTimes_.assign(queueSize_.value_,timeval());
+  builtTimes_.assign(queueSize_.value_,timeval());
+  for (unsigned int i=0;i<chains_.size();i++)
+    if (0!=chains_[i]) chains_[i]->release();
+  chains_.assign(queueSize_.value_,(toolbox::mem::Reference*)0);
+  batchHead_ =0;
+  batchTail_ =0;
+  batchBytes_=0;
+  batchIds_.clear();
+  sendLatencySumUs_=0.0;
+  sendLatencyMaxUs_=0.0;
+  sendLatencyN_    =0;
+  nbPosts_         =0;
+  sendLatencyHist_.reset();
+  discardLatencyHist_.reset();
+  histLastCount_=0;
+  histLastSumUs_=0;
+  nextBuildTime_=0.0;
+  validFedIds_.clear();
+  superFragFeds_.clear();
+  sfCalibSizes_.assign(FEDNumbering::MAXFEDID+1,0.0);
+  sfCalibN_=0;
+  while (!readEvents_.empty()) {
+    delete readEvents_.front().event;
+    readEvents_.pop();
+  }
+  sem_init(&readSlotSem_,0,readAheadDepth_);
+  sem_init(&readReadySem_,0,0);
+  replayCache_.clear();
+  replayCacheFull_=false;
+  replayNext_=0;
+  fakeLs_=0;
+}
+
+//______________________________________________________________________________
+double BU::deltaT(const struct timeval *start,const struct timeval *end)
+{
+  unsigned int  sec;
+  unsigned int  usec;
+  
+  sec = end->tv_sec - start->tv_sec;
+  
+  if(end->tv_usec > start->tv_usec) {
+    usec = end->tv_usec - start->tv_usec;
+  }
+  else {
+    sec--;
+    usec = 1000000 - ((unsigned int )(start->tv_usec - end->tv_usec));
+  }
+  
+  return ((double)sec) + ((double)usec) / 1000000.0;
+}
+
+
+//______________________________________________________________________________
+void BU::loadSuperFragTable() throw (evf::Exception)
+{
+  // one line per super fragment: '<superFragment> <fedId> [<fedId> ...]'
+  sfTable_.clear();
+  ifstream fin(superFragTable_.value_.c_str());
+  if (!fin.good())
+    XCEPT_RAISE(evf::Exception,
+		"Can't open superFragTable '"+superFragTable_.value_+"'.");
+  
+  string line;
+  while (getline(fin,line)) {
+    if (line.empty()||line[0]=='#') continue;
+    istringstream iss(line);
+    unsigned int superFrag,fedId;
+    if (!(iss>>superFrag)) continue;
+    // BUEvent keeps track of at most 1024 super fragments per event
+    if (superFrag>=1024) {
+      ostringstream oss;
+      oss<<"superFragTable: super fragment index "<<superFrag
+	 <<" exceeds the maximum of 1023.";
+      XCEPT_RAISE(evf::Exception,oss.str());
+    }
+    while (iss>>fedId) {
+      if (fedId>(unsigned int)FEDNumbering::MAXFEDID) {
+	LOG4CPLUS_WARN(log_,"superFragTable: ignore invalid fedid "<<fedId);
+	continue;
+      }
+      sfTable_[fedId]=superFrag;
+    }
+  }
+  if (sfTable_.empty())
+    XCEPT_RAISE(evf::Exception,
+		"No feds found in superFragTable '"+superFragTable_.value_+"'.");
+  LOG4CPLUS_INFO(log_,"superFragTable: "<<sfTable_.size()<<" feds assigned.");
+}
+
+
+//______________________________________________________________________________
+void BU::initSuperFrags(const vector<double>& fedSizes)
+{
+  superFragFeds_.clear();
+  
+  // INDEX: all feds in one list, split up per event by createMsgChain()
+  if (sfMode_==SF_INDEX) {
+    superFragFeds_.push_back(validFedIds_);
+    return;
+  }
+  
+  // TABLE: as configured, left-over feds are distributed round-robin
+  if (sfMode_==SF_TABLE) {
+    unsigned int nSuperFrag=0;
+    map<unsigned int,unsigned int>::const_iterator it;
+    for (it=sfTable_.begin();it!=sfTable_.end();++it)
+      nSuperFrag=std::max(nSuperFrag,it->second+1);
+    superFragFeds_.resize(nSuperFrag);
+    unsigned int nLeftOver=0;
+    for (unsigned int i=0;i<validFedIds_.size();i++) {
+      it=sfTable_.find(validFedIds_[i]);
+      if (it!=sfTable_.end()) superFragFeds_[it->second].push_back(validFedIds_[i]);
+      else superFragFeds_[nLeftOver++%nSuperFrag].push_back(validFedIds_[i]);
+    }
+    if (nLeftOver>0)
+      LOG4CPLUS_WARN(log_,nLeftOver<<" feds not in superFragTable, "
+		     <<"distributed round-robin.");
+    return;
+  }
+  
+  // BALANCED: largest feds first, each into the least loaded super fragment
+  unsigned int nSuperFrag=std::max(1U,nbSuperFrags_.value_);
+  superFragFeds_.resize(nSuperFrag);
+  
+  vector<pair<double,unsigned int> > feds;
+  for (unsigned int i=0;i<validFedIds_.size();i++)
+    feds.push_back(make_pair(-fedSizes[validFedIds_[i]],validFedIds_[i]));
+  std::stable_sort(feds.begin(),feds.end());
+  
+  typedef pair<double,unsigned int> Load;
+  priority_queue<Load,vector<Load>,greater<Load> > loads;
+  for (unsigned int i=0;i<nSuperFrag;i++) loads.push(Load(0.0,i));
+  for (unsigned int i=0;i<feds.size();i++) {
+    Load load=loads.top(); loads.pop();
+    superFragFeds_[load.second].push_back(feds[i].second);
+    load.first-=feds[i].first;
+    loads.push(load);
+  }
+  for (unsigned int i=0;i<nSuperFrag;i++)
+    std::sort(superFragFeds_[i].begin(),superFragFeds_[i].end());
+}
+
+
+//______________________________________________________________________________
+bool BU::isPlaybackRunning()
+{
+  if (0==PlaybackRawDataProvider::instance()) return false;
+  if (!replay_.value_)                        return true;
+  if (replayCacheSize_.value_>0)              return !replayCacheFull_;
+  return nbEventsBuilt_<(uint32_t)events_.size();
+}
+
+
+//______________________________________________________________________________
+FEDRawDataCollection* BU::readPlaybackEvent(unsigned int& runNumber,
+					    unsigned int& evtNumber)
+{
+  if (!isReadAhead_)
+    return PlaybackRawDataProvider::instance()->getFEDRawData(runNumber,evtNumber);
+  
+  sem_wait(&readReadySem_);
+  lock();
+  ReadEvent read=readEvents_.front(); readEvents_.pop();
+  unlock();
+  if (0!=read.event) sem_post(&readSlotSem_);
+  
+  runNumber=read.runNumber;
+  evtNumber=read.evtNumber;
+  return read.event;
+}
+
+
+//______________________________________________________________________________
+void BU::stopReadAhead()
+{
+  // the builder doesn't take events anymore, read (and drop) the remaining
+  // ones once setFreeToEof() was called
+  if (!isReading_||isReadDraining_) return;
+  isReadDraining_=true;
+  sem_post(&readSlotSem_);
+}
+
+
+//______________________________________________________________________________
+void BU::waitReadAhead()
+{
+  while (isReading_) {
+    LOG4CPLUS_INFO(log_,"wait for 'reading' workloop to reach end of playback ...");
+    ::sleep(1);
+  }
+}
+
+
+//______________________________________________________________________________
+void BU::overwriteFed(unsigned char* fedAddr,unsigned int fedSize,
+		      unsigned int offset,const void* data,unsigned int n)
+{
+  // keep the trailer crc valid, unless the fed doesn't have one
+  if (patchCrc_.value_) crcPatch_.write(fedAddr,fedSize,offset,data,n);
+  else memcpy(fedAddr+offset,data,n);
+}
+
+
+//______________________________________________________________________________
+bool BU::generateEvent(BUEvent* evt,const GeneratorConfig::Settings& gen)
+{
+  // counted by building() once the event is built, see there
+  evtClass_=-1;
+  
+  // replay?
+  if (replay_.value_&&replayCacheSize_.value_==0&&
+      nbEventsBuilt_>=(uint32_t)events_.size()) 
+    {
+      if (0!=PlaybackRawDataProvider::instance()) {
+        PlaybackRawDataProvider::instance()->setFreeToEof();
+	stopReadAhead();
+      }
+      return true;
+    }  
+  // replay from the cache once it is full
+  if (replayCacheFull_) {
+    if (!replayCache_.fill(replayNext_,evt)) {
+      // out of event memory: dropped by building(), replayed again next time
+      if (evt->isTruncated()) return true;
+      LOG4CPLUS_ERROR(log_,"Failed to replay cached event "<<replayNext_);
+      return false;
+    }
+    if (++replayNext_>=replayCache_.size()) replayNext_=0;
+    return true;
+  }
   // PLAYBACK mode
   if (0!=PlaybackRawDataProvider::instance()) {
     
     unsigned int runNumber,evtNumber;
 
-    FEDRawDataCollection* event=
-      PlaybackRawDataProvider::instance()->getFEDRawData(runNumber,evtNumber);
-    if(event == 0) return false;
+    FEDRawDataCollection* event=readPlaybackEvent(runNumber,evtNumber);
+    if(event == 0) {
+      // end of playback before the cache is full: replay what we have
+      if (replay_.value_&&replayCache_.size()>0) {
+	LOG4CPLUS_INFO(log_,"replay "<<replayCache_.size()<<" cached events.");
+	replayCacheFull_=true;
+	return generateEvent(evt,gen);
+      }
+      return false;
+    }
     evt->initialize(evtNumber);
     
-    for (unsigned int i=0;i<validFedIds_.size();i++) {
-      unsigned int   fedId  =validFedIds_[i];
-      unsigned int   fedSize=event->FEDData(fedId).size();
-      unsigned char* fedAddr=event->FEDData(fedId).data();
-      if (overwriteEvtId_.value_ && fedAddr != 0) {
-	fedh_t *fedHeader=(fedh_t*)fedAddr;
-	fedHeader->eventid=(fedHeader->eventid&0xFF000000)+(evtNumber&0x00FFFFFF);
+    for (unsigned int iSuperFrag=0;iSuperFrag<superFragFeds_.size()&&
+	   !evt->isTruncated();iSuperFrag++) {
+      const vector<unsigned int>& feds=superFragFeds_[iSuperFrag];
+      evt->startSuperFrag();
+      for (unsigned int i=0;i<feds.size()&&!evt->isTruncated();i++) {
+	unsigned int   fedId  =feds[i];
+	unsigned int   fedSize=event->FEDData(fedId).size();
+	unsigned char* fedAddr=event->FEDData(fedId).data();
+	if (overwriteEvtId_.value_ && fedAddr != 0) {
+	  fedh_t *fedHeader=(fedh_t*)fedAddr;
+	  unsigned int eventid=(fedHeader->eventid&0xFF000000)+(evtNumber&0x00FFFFFF);
+	  overwriteFed(fedAddr,fedSize,offsetof(fedh_t,eventid),
+		       &eventid,sizeof(eventid));
+	}
+	if (fedSize>0) evt->writeFed(fedId,fedAddr,fedSize);
       }
-      if (fedSize>0) evt->writeFed(fedId,fedAddr,fedSize);
     }
     delete event;
+    if (evt->isTruncated()) return true;
+    
+    // balance super fragments according to the fed sizes of the first events
+    if (sfMode_==SF_BALANCED&&sfCalibN_<superFragCalibEvents_.value_) {
+      for (unsigned int i=0;i<evt->nFed();i++)
+	sfCalibSizes_[evt->fedId(i)]+=evt->fedSize(i);
+      if (++sfCalibN_==superFragCalibEvents_.value_) {
+	initSuperFrags(sfCalibSizes_);
+	LOG4CPLUS_INFO(log_,"super fragments balanced after "<<sfCalibN_<<" events.");
+      }
+    }
   }
   // RANDOM mode
   else {
     unsigned int evtNumber=(firstEvent_+evtNumber_++)%0x1000000;
     evt->initialize(evtNumber);
     unsigned int fedSizeMin=fedHeaderSize_+fedTrailerSize_;
-    for (unsigned int i=0;i<validFedIds_.size();i++) {
-      unsigned int fedId(validFedIds_[i]);
-      unsigned int fedSize(fedSizeMean_);
-      if (!useFixedFedSize_) {
-	double logFedSize=CLHEP::RandGauss::shoot(gaussianMean_,gaussianWidth_);
-	fedSize=(unsigned int)(std::exp(logFedSize));
-	if (fedSize<fedSizeMin)  fedSize=fedSizeMin;
-	if (fedSize>fedSizeMax_) fedSize=fedSizeMax_;
-	fedSize-=fedSize%8;
+
+    // draw the event class, which restricts the feds and their sizes
+    const EventClasses::EventClass* evtClass=0;
+    unsigned int fedSizeMean  =gen.fedSizeMean;
+    bool         fixedFedSize =gen.fixedFedSize;
+    double       gaussianMean =gen.gaussianMean;
+    double       gaussianWidth=gen.gaussianWidth;
+    if (gen.eventClasses.size()>0) {
+      unsigned int iClass=gen.eventClasses.sample(CLHEP::RandFlat::shoot());
+      evtClass     =&gen.eventClasses[iClass];
+      fedSizeMean  =evtClass->fedSizeMean;
+      fixedFedSize =(evtClass->fedSizeWidth==0);
+      gaussianMean =evtClass->gaussianMean;
+      gaussianWidth=evtClass->gaussianWidth;
+      evt->setEvtType(evtClass->evtType);
+      evtClass_    =iClass;
+    }
+
+    for (unsigned int iSuperFrag=0;iSuperFrag<superFragFeds_.size()&&
+	   !evt->isTruncated();iSuperFrag++) {
+      const vector<unsigned int>& feds=superFragFeds_[iSuperFrag];
+      evt->startSuperFrag();
+      for (unsigned int i=0;i<feds.size()&&!evt->isTruncated();i++) {
+	unsigned int fedId(feds[i]);
+	if (0!=evtClass&&!evtClass->feds[fedId]) continue;
+	unsigned int fedSize(fedSizeMean);
+	if (!fixedFedSize) {
+	  double logFedSize=CLHEP::RandGauss::shoot(gaussianMean,gaussianWidth);
+	  fedSize=(unsigned int)(std::exp(logFedSize));
+	  if (fedSize<fedSizeMin)  fedSize=fedSizeMin;
+	  if (fedSize>gen.fedSizeMax) fedSize=gen.fedSizeMax;
+	  fedSize-=fedSize%8;
+	}
+	
+	if (!evt->writeFed(fedId,0,fedSize)) continue;
+	if (fedSize>fedSizeMin)
+	  payload_.fill(evt->fedAddr(evt->nFed()-1)+fedHeaderSize_,
+			fedSize-fedSizeMin);
+	evt->writeFedHeader(evt->nFed()-1);
+	evt->writeFedTrailer(evt->nFed()-1);
       }
-      
-      evt->writeFed(fedId,0,fedSize);
-      evt->writeFedHeader(i);
-      evt->writeFedTrailer(i);
+    }
+    // the event number is reused by the next event
+    if (evt->isTruncated()) {
+      evtNumber_--;
+      return true;
     }
     
   }
+  
+  // fill the replay cache
+  if (replay_.value_&&replayCacheSize_.value_>0) {
+    replayCache_.add(evt);
+    if (replayCache_.size()>=replayCacheSize_.value_) {
+      LOG4CPLUS_INFO(log_,"replay cache full: "<<replayCache_.size()<<" events, "
+		     <<replayCache_.rawSize()/1048576<<" MB compressed to "
+		     <<replayCache_.compressedSize()/1048576<<" MB.");
+      replayCacheFull_=true;
+      if (0!=PlaybackRawDataProvider::instance()) {
+        PlaybackRawDataProvider::instance()->setFreeToEof();
+	stopReadAhead();
+      }
+    }
+  }
   return true;
 }
 
@@ -831,7 +2684,7 @@ toolbox::mem::Reference *BU::createMsgChain(BUEvent* evt,
 
     int gtpFedPos_=-1;
     int egtpFedPos_=-1;
-    for (size_t k=0;k<validFedIds_.size();k++) {
+    for (size_t k=0;k<evt->nFed();k++) {
       if (evt->fedId(k)==FEDNumbering::MINTriggerGTPFEDID) {
       //insert ls value into gtp fed
 	unsigned char * fgtpAddr = evt->fedAddr(k);
@@ -839,20 +2692,25 @@ toolbox::mem::Reference *BU::createMsgChain(BUEvent* evt,
 	if (fgtpAddr && fgtpSize) {
 	  gtpFedPos_=(int)k;
           evtn::evm_board_sense(fgtpAddr,fgtpSize);
-	  *((unsigned short*)fgtpAddr
-	      +sizeof(fedh_t)/sizeof(unsigned short)
-	      + (evtn::EVM_GTFE_BLOCK*2 + evtn::EVM_TCS_LSBLNR_OFFSET)*evtn::SLINK_HALFWORD_SIZE /sizeof(unsigned short)
-	   ) = (unsigned short)fakeLs_-1;
+	  unsigned short ls=(unsigned short)fakeLs_-1;
+	  overwriteFed(fgtpAddr,fgtpSize,
+		       sizeof(unsigned short)*
+		       (sizeof(fedh_t)/sizeof(unsigned short)
+			+ (evtn::EVM_GTFE_BLOCK*2 + evtn::EVM_TCS_LSBLNR_OFFSET)*evtn::SLINK_HALFWORD_SIZE /sizeof(unsigned short)),
+		       &ls,sizeof(ls));
 	}
       }
       if (evt->fedId(k)==FEDNumbering::MINTriggerEGTPFEDID) {
         //insert orbit value into gtpe fed
-	unsigned char * fegtpAddr = evt->fedAddr(egtpFedPos_);
-	unsigned int fegtpSize = evt->fedSize(egtpFedPos_);
+	unsigned char * fegtpAddr = evt->fedAddr(k);
+	unsigned int fegtpSize = evt->fedSize(k);
 	if (fegtpAddr && fegtpSize) {
 	  egtpFedPos_=(int)k;
-	  *(  (unsigned int*)fegtpAddr + evtn::GTPE_ORBTNR_OFFSET * evtn::SLINK_HALFWORD_SIZE/sizeof(unsigned int)
-	   ) = (unsigned int)(fakeLs_-1)*0x00100000;
+	  unsigned int orbit=(unsigned int)(fakeLs_-1)*0x00100000;
+	  overwriteFed(fegtpAddr,fegtpSize,
+		       sizeof(unsigned int)*
+		       (evtn::GTPE_ORBTNR_OFFSET * evtn::SLINK_HALFWORD_SIZE/sizeof(unsigned int)),
+		       &orbit,sizeof(orbit));
 	}
       }
     }
@@ -862,120 +2720,229 @@ toolbox::mem::Reference *BU::createMsgChain(BUEvent* evt,
 
   toolbox::mem::Reference *head  =0;
   toolbox::mem::Reference *tail  =0;
+  
+  unsigned int nSuperFrag=0;
+  
+  // compute index of first (and last) fed of each super fragment
+  if (sfMode_==SF_INDEX) {
+    nSuperFrag=64;
+    unsigned int nFedPerSuperFrag=validFedIds_.size()/nSuperFrag;
+    unsigned int nBigSuperFrags  =validFedIds_.size()%nSuperFrag;
+    
+    if (evt->nFed()<nSuperFrag) {
+      nSuperFrag=evt->nFed();
+      nFedPerSuperFrag=1;
+      nBigSuperFrags=0;
+    }
+    else
+      {
+	nFedPerSuperFrag=evt->nFed()/nSuperFrag;
+	nBigSuperFrags  =evt->nFed()%nSuperFrag;
+      }
+    
+    sfFirstFed_.resize(nSuperFrag+1);
+    unsigned int iFed=0;
+    for (unsigned int iSuperFrag=0;iSuperFrag<nSuperFrag;iSuperFrag++) {
+      sfFirstFed_[iSuperFrag]=iFed;
+      iFed+=nFedPerSuperFrag;
+      if (iSuperFrag<nBigSuperFrags) ++iFed;
+    }
+    sfFirstFed_[nSuperFrag]=iFed;
+  }
+  // super fragments were laid out by generateEvent(), see initSuperFrags();
+  // those without feds (e.g. none of the event class) are dropped
+  else {
+    unsigned int nEvtSuperFrag=evt->nSuperFrag();
+    sfFirstFed_.resize(nEvtSuperFrag+1);
+    for (unsigned int iSuperFrag=0;iSuperFrag<nEvtSuperFrag;iSuperFrag++) {
+      unsigned int first=evt->superFragFirstFed(iSuperFrag);
+      unsigned int next =(iSuperFrag+1<nEvtSuperFrag) ?
+	evt->superFragFirstFed(iSuperFrag+1) : evt->nFed();
+      if (first<next) sfFirstFed_[nSuperFrag++]=first;
+    }
+    sfFirstFed_[nSuperFrag]=evt->nFed();
+  }
+  sfHead_.assign(nSuperFrag,(toolbox::mem::Reference*)0);
+  sfTail_.assign(nSuperFrag,(toolbox::mem::Reference*)0);
+  
+  // serialize all super fragments, with the help of the 'serializing'
+  // workloops for large events
+  serEvt_          =evt;
+  serFuResourceId_ =fuResourceId;
+  serNSuperFrag_   =nSuperFrag;
+  serNextSuperFrag_=0;
+  
+  // the helpers can't be stopped while they work on this event
+  bool         parallel=(nSuperFrag>1&&
+			 evt->evtSize()>=parallelSerializeMinSize_.value_);
+  unsigned int nHelper =0;
+  if (parallel) {
+    sem_wait(&serializeMutex_);
+    nHelper=std::min(nbSerializersActive_,nSuperFrag-1);
+  }
+  
+  for (unsigned int i=0;i<nHelper;i++) sem_post(&serializeSem_);
+  serializeSuperFrags();
+  for (unsigned int i=0;i<nHelper;i++) sem_wait(&serializeDoneSem_);
+  if (parallel) sem_post(&serializeMutex_);
+  
+  // splice the sub-chains in super fragment order
+  for (unsigned int iSuperFrag=0;iSuperFrag<nSuperFrag;iSuperFrag++) {
+    if (0==sfHead_[iSuperFrag]) continue;
+    if (0==head) head=sfHead_[iSuperFrag];
+    else         tail->setNextReference(sfHead_[iSuperFrag]);
+    tail=sfTail_[iSuperFrag];
+  }
+  
+  return head; // return the top of the chain
+}
+
+
+//______________________________________________________________________________
+void BU::serializeSuperFrags()
+{
+  unsigned int iSuperFrag;
+  while ((iSuperFrag=__sync_fetch_and_add(&serNextSuperFrag_,1))<serNSuperFrag_)
+    createSuperFrag(serEvt_,serFuResourceId_,iSuperFrag,serNSuperFrag_,
+		    sfFirstFed_[iSuperFrag],sfFirstFed_[iSuperFrag+1],
+		    sfHead_[iSuperFrag],sfTail_[iSuperFrag]);
+}
+
+
+//______________________________________________________________________________
+void BU::createSuperFrag(BUEvent* evt,
+			 unsigned int fuResourceId,
+			 unsigned int iSuperFrag,
+			 unsigned int nSuperFrag,
+			 unsigned int iFed,
+			 unsigned int nFed,
+			 toolbox::mem::Reference*& head,
+			 toolbox::mem::Reference*& tail)
+{
+  unsigned int msgHeaderSize =sizeof(I2O_EVENT_DATA_BLOCK_MESSAGE_FRAME);
+  unsigned int msgPayloadSize=msgBufferSize_-msgHeaderSize;
+  
   toolbox::mem::Reference *bufRef=0;
   
   I2O_MESSAGE_FRAME                  *stdMsg=0;
   I2O_PRIVATE_MESSAGE_FRAME          *pvtMsg=0;
   I2O_EVENT_DATA_BLOCK_MESSAGE_FRAME *block =0;
   
-  unsigned int iFed            =0;
-  unsigned int nSuperFrag      =64;
-  unsigned int nFedPerSuperFrag=validFedIds_.size()/nSuperFrag;
-  unsigned int nBigSuperFrags  =validFedIds_.size()%nSuperFrag;
-  
-  if (evt->nFed()<nSuperFrag) {
-    nSuperFrag=evt->nFed();
-    nFedPerSuperFrag=1;
-    nBigSuperFrags=0;
+  // compute number of blocks in this super fragment
+  unsigned int nBlock  =0;
+  unsigned int curbSize=frlHeaderSize_;
+  unsigned int totSize =curbSize;
+  for (unsigned int i=iFed;i<nFed;i++) {
+    curbSize+=evt->fedSize(i);
+    totSize+=evt->fedSize(i);
+    if (curbSize>msgPayloadSize) {
+      curbSize+=frlHeaderSize_*(curbSize/msgPayloadSize);
+      if(curbSize%msgPayloadSize)totSize+=frlHeaderSize_*(curbSize/msgPayloadSize);
+      else totSize+=frlHeaderSize_*((curbSize/msgPayloadSize)-1);
+      curbSize=curbSize%msgPayloadSize;
+    }
   }
-  else
-    {
-      nFedPerSuperFrag=evt->nFed()/nSuperFrag;
-      nBigSuperFrags  =evt->nFed()%nSuperFrag;
+  nBlock=totSize/msgPayloadSize+(totSize%msgPayloadSize>0 ? 1 : 0);
+
+
+  // loop over all blocks (msgs) in the current super fragment
+  unsigned int   remainder     =0;
+  bool           fedTrailerLeft=false;
+  bool           last          =false;
+  bool           warning       =false;
+  unsigned char *startOfPayload=0;
+  U32            payload(0);
+
+  for(unsigned int iBlock=0;iBlock<nBlock;iBlock++) {
+
+    // If last block and its partial (there can be only 0 or 1 partial)
+    payload=msgPayloadSize;
+
+    // Allocate memory for a fragment block / message
+    try {
+      bufRef=toolbox::mem::getMemoryPoolFactory()->getFrame(i2oPool_,
+							    msgBufferSize_);
     }
-  // loop over all super fragments
-  for (unsigned int iSuperFrag=0;iSuperFrag<nSuperFrag;iSuperFrag++) {
-    
-    // compute index of last fed in this super fragment
-    unsigned int nFed=iFed+nFedPerSuperFrag;
-    if (iSuperFrag<nBigSuperFrags) ++nFed;
-    
-    // compute number of blocks in this super fragment
-    unsigned int nBlock  =0;
-    unsigned int curbSize=frlHeaderSize_;
-    unsigned int totSize =curbSize;
-    for (unsigned int i=iFed;i<nFed;i++) {
-      curbSize+=evt->fedSize(i);
-      totSize+=evt->fedSize(i);
-      if (curbSize>msgPayloadSize) {
-	curbSize+=frlHeaderSize_*(curbSize/msgPayloadSize);
-	if(curbSize%msgPayloadSize)totSize+=frlHeaderSize_*(curbSize/msgPayloadSize);
-	else totSize+=frlHeaderSize_*((curbSize/msgPayloadSize)-1);
-	curbSize=curbSize%msgPayloadSize;
-      }
+    catch(xcept::Exception &e) {
+      LOG4CPLUS_FATAL(log_,"xdaq::frameAlloc failed");
     }
-    nBlock=totSize/msgPayloadSize+(totSize%msgPayloadSize>0 ? 1 : 0);
-    
-    
-    // loop over all blocks (msgs) in the current super fragment
-    unsigned int   remainder     =0;
-    bool           fedTrailerLeft=false;
-    bool           last          =false;
-    bool           warning       =false;
-    unsigned char *startOfPayload=0;
-    U32            payload(0);
-    
-    for(unsigned int iBlock=0;iBlock<nBlock;iBlock++) {
-      
-      // If last block and its partial (there can be only 0 or 1 partial)
-      payload=msgPayloadSize;
-      
-      // Allocate memory for a fragment block / message
-      try {
-	bufRef=toolbox::mem::getMemoryPoolFactory()->getFrame(i2oPool_,
-							      msgBufferSize_);
-      }
-      catch(xcept::Exception &e) {
-	LOG4CPLUS_FATAL(log_,"xdaq::frameAlloc failed");
+
+    // Fill in the fields of the fragment block / message
+    stdMsg=(I2O_MESSAGE_FRAME*)bufRef->getDataLocation();
+    pvtMsg=(I2O_PRIVATE_MESSAGE_FRAME*)stdMsg;
+    block =(I2O_EVENT_DATA_BLOCK_MESSAGE_FRAME*)stdMsg;
+
+    pvtMsg->XFunctionCode   =I2O_FU_TAKE;
+    pvtMsg->OrganizationID  =XDAQ_ORGANIZATION_ID;
+
+    stdMsg->MessageSize     =(msgHeaderSize + payload) >> 2;
+    stdMsg->Function        =I2O_PRIVATE_MESSAGE;
+    stdMsg->VersionOffset   =0;
+    stdMsg->MsgFlags        =0;
+    stdMsg->InitiatorAddress=buTid_;
+    stdMsg->TargetAddress   =fuTid_;
+
+    block->buResourceId           =evt->buResourceId();
+    block->fuTransactionId        =fuResourceId;
+    block->blockNb                =iBlock;
+    block->nbBlocksInSuperFragment=nBlock;
+    block->superFragmentNb        =iSuperFrag;
+    block->nbSuperFragmentsInEvent=nSuperFrag;
+    block->eventNumber            =evt->evtNumber();
+
+    // Fill in payload 
+    startOfPayload   =(unsigned char*)block+msgHeaderSize;
+    frlh_t* frlHeader=(frlh_t*)startOfPayload;
+    frlHeader->trigno=evt->evtNumber();
+    frlHeader->segno =iBlock;
+
+    unsigned char *startOfFedBlocks=startOfPayload+frlHeaderSize_;
+    payload              -=frlHeaderSize_;
+    frlHeader->segsize    =payload;
+    unsigned int leftspace=payload;
+
+    // a fed trailer was left over from the previous block
+    if(fedTrailerLeft) {
+      memcpy(startOfFedBlocks,
+	     evt->fedAddr(iFed)+evt->fedSize(iFed)-fedTrailerSize_,
+	     fedTrailerSize_);
+
+      startOfFedBlocks+=fedTrailerSize_;
+      leftspace       -=fedTrailerSize_;
+      remainder        =0;
+      fedTrailerLeft   =false;
+
+      // if this is the last fed, adjust block (msg) size and set last=true
+      if((iFed==nFed-1) && !last) {
+	frlHeader->segsize-=leftspace;
+	int msgSize=stdMsg->MessageSize << 2;
+	msgSize   -=leftspace;
+	bufRef->setDataSize(msgSize);
+	stdMsg->MessageSize = msgSize >> 2;
+	frlHeader->segsize=frlHeader->segsize | FRL_LAST_SEGM;
+	last=true;
       }
-      
-      // Fill in the fields of the fragment block / message
-      stdMsg=(I2O_MESSAGE_FRAME*)bufRef->getDataLocation();
-      pvtMsg=(I2O_PRIVATE_MESSAGE_FRAME*)stdMsg;
-      block =(I2O_EVENT_DATA_BLOCK_MESSAGE_FRAME*)stdMsg;
-      
-      pvtMsg->XFunctionCode   =I2O_FU_TAKE;
-      pvtMsg->OrganizationID  =XDAQ_ORGANIZATION_ID;
-      
-      stdMsg->MessageSize     =(msgHeaderSize + payload) >> 2;
-      stdMsg->Function        =I2O_PRIVATE_MESSAGE;
-      stdMsg->VersionOffset   =0;
-      stdMsg->MsgFlags        =0;
-      stdMsg->InitiatorAddress=i2o::utils::getAddressMap()->getTid(buAppDesc_);
-      stdMsg->TargetAddress   =i2o::utils::getAddressMap()->getTid(fuAppDesc_);
-      
-      block->buResourceId           =evt->buResourceId();
-      block->fuTransactionId        =fuResourceId;
-      block->blockNb                =iBlock;
-      block->nbBlocksInSuperFragment=nBlock;
-      block->superFragmentNb        =iSuperFrag;
-      block->nbSuperFragmentsInEvent=nSuperFrag;
-      block->eventNumber            =evt->evtNumber();
-      
-      // Fill in payload 
-      startOfPayload   =(unsigned char*)block+msgHeaderSize;
-      frlh_t* frlHeader=(frlh_t*)startOfPayload;
-      frlHeader->trigno=evt->evtNumber();
-      frlHeader->segno =iBlock;
-      
-      unsigned char *startOfFedBlocks=startOfPayload+frlHeaderSize_;
-      payload              -=frlHeaderSize_;
-      frlHeader->segsize    =payload;
-      unsigned int leftspace=payload;
-      
-      // a fed trailer was left over from the previous block
-      if(fedTrailerLeft) {
-	memcpy(startOfFedBlocks,
-	       evt->fedAddr(iFed)+evt->fedSize(iFed)-fedTrailerSize_,
-	       fedTrailerSize_);
-	
-	startOfFedBlocks+=fedTrailerSize_;
-	leftspace       -=fedTrailerSize_;
-	remainder        =0;
-	fedTrailerLeft   =false;
-	
-	// if this is the last fed, adjust block (msg) size and set last=true
-	if((iFed==nFed-1) && !last) {
+
+      // !! increment iFed !!
+      iFed++;
+    }
+
+    //!
+    //! remainder>0 means that a partial fed is left over from the last block
+    //!
+    if (remainder>0) {
+
+      // the remaining fed fits entirely into the new block
+      if(payload>=remainder) {
+	FastCopy::copy(startOfFedBlocks,
+		       evt->fedAddr(iFed)+evt->fedSize(iFed)-remainder,
+		       remainder);
+
+	startOfFedBlocks+=remainder;
+	leftspace       -=remainder;
+
+	// if this is the last fed in the superfragment, earmark it
+	if(iFed==nFed-1) {
 	  frlHeader->segsize-=leftspace;
 	  int msgSize=stdMsg->MessageSize << 2;
 	  msgSize   -=leftspace;
@@ -984,159 +2951,126 @@ toolbox::mem::Reference *BU::createMsgChain(BUEvent* evt,
 	  frlHeader->segsize=frlHeader->segsize | FRL_LAST_SEGM;
 	  last=true;
 	}
-	
+
 	// !! increment iFed !!
 	iFed++;
+
+	// start new fed -> set remainder to 0!
+	remainder=0;
       }
-      
-      //!
-      //! remainder>0 means that a partial fed is left over from the last block
-      //!
-      if (remainder>0) {
-	
-	// the remaining fed fits entirely into the new block
-	if(payload>=remainder) {
-	  memcpy(startOfFedBlocks,
-		 evt->fedAddr(iFed)+evt->fedSize(iFed)-remainder,
-		 remainder);
-	  
-	  startOfFedBlocks+=remainder;
-	  leftspace       -=remainder;
-	  
-	  // if this is the last fed in the superfragment, earmark it
-	  if(iFed==nFed-1) {
-	    frlHeader->segsize-=leftspace;
-	    int msgSize=stdMsg->MessageSize << 2;
-	    msgSize   -=leftspace;
-	    bufRef->setDataSize(msgSize);
-	    stdMsg->MessageSize = msgSize >> 2;
-	    frlHeader->segsize=frlHeader->segsize | FRL_LAST_SEGM;
-	    last=true;
-	  }
-	  
-	  // !! increment iFed !!
-	  iFed++;
-	  
-	  // start new fed -> set remainder to 0!
-	  remainder=0;
-	}
-	// the remaining payload fits, but not the fed trailer
-	else if (payload>=(remainder-fedTrailerSize_)) {
-	  memcpy(startOfFedBlocks,
-		 evt->fedAddr(iFed)+evt->fedSize(iFed)-remainder,
-		 remainder-fedTrailerSize_);
-	  
-	  frlHeader->segsize=remainder-fedTrailerSize_;
-	  fedTrailerLeft    =true;
-	  leftspace        -=(remainder-fedTrailerSize_);
-	  remainder         =fedTrailerSize_;
+      // the remaining payload fits, but not the fed trailer
+      else if (payload>=(remainder-fedTrailerSize_)) {
+	FastCopy::copy(startOfFedBlocks,
+		       evt->fedAddr(iFed)+evt->fedSize(iFed)-remainder,
+		       remainder-fedTrailerSize_);
+
+	frlHeader->segsize=remainder-fedTrailerSize_;
+	fedTrailerLeft    =true;
+	leftspace        -=(remainder-fedTrailerSize_);
+	remainder         =fedTrailerSize_;
+      }
+      // the remaining payload fits only partially, fill whole block
+      else {
+	FastCopy::copy(startOfFedBlocks,
+		       evt->fedAddr(iFed)+evt->fedSize(iFed)-remainder,payload);
+	remainder-=payload;
+	leftspace =0;
+      }
+    }
+
+    //!
+    //! no remaining fed data
+    //!
+    if(remainder==0) {
+
+      // loop on feds
+      while(iFed<nFed) {
+
+	// if the next header does not fit, jump to following block
+	if((int)leftspace<fedHeaderSize_) {
+	  frlHeader->segsize-=leftspace;
+	  break;
 	}
-	// the remaining payload fits only partially, fill whole block
-	else {
-	  memcpy(startOfFedBlocks,
-		 evt->fedAddr(iFed)+evt->fedSize(iFed)-remainder,payload);
-	  remainder-=payload;
-	  leftspace =0;
+
+	memcpy(startOfFedBlocks,evt->fedAddr(iFed),fedHeaderSize_);
+
+	leftspace       -=fedHeaderSize_;
+	startOfFedBlocks+=fedHeaderSize_;
+
+	// fed fits with its trailer
+	if(evt->fedSize(iFed)-fedHeaderSize_<=leftspace) {
+	  FastCopy::copy(startOfFedBlocks,
+			 evt->fedAddr(iFed)+fedHeaderSize_,
+			 evt->fedSize(iFed)-fedHeaderSize_);
+
+	  leftspace       -=(evt->fedSize(iFed)-fedHeaderSize_);
+	  startOfFedBlocks+=(evt->fedSize(iFed)-fedHeaderSize_);
 	}
-      }
-      
-      //!
-      //! no remaining fed data
-      //!
-      if(remainder==0) {
-	
-	// loop on feds
-	while(iFed<nFed) {
-	  
-	  // if the next header does not fit, jump to following block
-	  if((int)leftspace<fedHeaderSize_) {
-	    frlHeader->segsize-=leftspace;
-	    break;
-	  }
-	  
-	  memcpy(startOfFedBlocks,evt->fedAddr(iFed),fedHeaderSize_);
-	  
-	  leftspace       -=fedHeaderSize_;
-	  startOfFedBlocks+=fedHeaderSize_;
-	  
-	  // fed fits with its trailer
-	  if(evt->fedSize(iFed)-fedHeaderSize_<=leftspace) {
-	    memcpy(startOfFedBlocks,
-		   evt->fedAddr(iFed)+fedHeaderSize_,
-		   evt->fedSize(iFed)-fedHeaderSize_);
-	    
-	    leftspace       -=(evt->fedSize(iFed)-fedHeaderSize_);
-	    startOfFedBlocks+=(evt->fedSize(iFed)-fedHeaderSize_);
-	  }
-	  // fed payload fits only without fed trailer
-	  else if(evt->fedSize(iFed)-fedHeaderSize_-fedTrailerSize_<=leftspace) {
-	    memcpy(startOfFedBlocks,
-		   evt->fedAddr(iFed)+fedHeaderSize_,
-		   evt->fedSize(iFed)-fedHeaderSize_-fedTrailerSize_);
-	    
-	    leftspace         -=(evt->fedSize(iFed)-fedHeaderSize_-fedTrailerSize_);
-	    frlHeader->segsize-=leftspace;
-	    fedTrailerLeft     =true;
-	    remainder          =fedTrailerSize_;
-	    
-	    break;
-	  }
-	  // fed payload fits only partially
-	  else {
-	    memcpy(startOfFedBlocks,evt->fedAddr(iFed)+fedHeaderSize_,leftspace);
-	    remainder=evt->fedSize(iFed)-fedHeaderSize_-leftspace;
-	    leftspace=0;
-	    
-	    break;
-	  }
-	  
-	  // !! increase iFed !!
-	  iFed++;
-	  
-	} // while (iFed<fedN_)
-	
-	// earmark the last block
-	if (iFed==nFed && remainder==0 && !last) {
+	// fed payload fits only without fed trailer
+	else if(evt->fedSize(iFed)-fedHeaderSize_-fedTrailerSize_<=leftspace) {
+	  FastCopy::copy(startOfFedBlocks,
+			 evt->fedAddr(iFed)+fedHeaderSize_,
+			 evt->fedSize(iFed)-fedHeaderSize_-fedTrailerSize_);
+
+	  leftspace         -=(evt->fedSize(iFed)-fedHeaderSize_-fedTrailerSize_);
 	  frlHeader->segsize-=leftspace;
-	  int msgSize=stdMsg->MessageSize << 2;
-	  msgSize   -=leftspace;
-	  bufRef->setDataSize(msgSize);
-	  stdMsg->MessageSize=msgSize >> 2;
-	  frlHeader->segsize =frlHeader->segsize | FRL_LAST_SEGM;
-	  last=true;
+	  fedTrailerLeft     =true;
+	  remainder          =fedTrailerSize_;
+
+	  break;
 	}
-	
-      } // if (remainder==0)
-      
-      if(iSuperFrag==0&&iBlock==0) { // This is the first fragment block / message
-	head=bufRef;
-	tail=bufRef;
-      }
-      else {
-	tail->setNextReference(bufRef);
-	tail=bufRef;
-      }
-      
-      if((iBlock==nBlock-1) && remainder!=0) {
-	nBlock++;
-	warning=true;
+	// fed payload fits only partially
+	else {
+	  FastCopy::copy(startOfFedBlocks,evt->fedAddr(iFed)+fedHeaderSize_,leftspace);
+	  remainder=evt->fedSize(iFed)-fedHeaderSize_-leftspace;
+	  leftspace=0;
+
+	  break;
+	}
+
+	// !! increase iFed !!
+	iFed++;
+
+      } // while (iFed<fedN_)
+
+      // earmark the last block
+      if (iFed==nFed && remainder==0 && !last) {
+	frlHeader->segsize-=leftspace;
+	int msgSize=stdMsg->MessageSize << 2;
+	msgSize   -=leftspace;
+	bufRef->setDataSize(msgSize);
+	stdMsg->MessageSize=msgSize >> 2;
+	frlHeader->segsize =frlHeader->segsize | FRL_LAST_SEGM;
+	last=true;
       }
-      
-    } // for (iBlock)
-    
-    // fix case where block estimate was wrong
-    if(warning) {
-      toolbox::mem::Reference* next=head;
-      do {
-	block =(I2O_EVENT_DATA_BLOCK_MESSAGE_FRAME*)next->getDataLocation();
-	if (block->superFragmentNb==iSuperFrag)
-	  block->nbBlocksInSuperFragment=nBlock;		
-      } while((next=next->getNextReference()));
+
+    } // if (remainder==0)
+
+    if(iBlock==0) { // This is the first fragment block / message
+      head=bufRef;
+      tail=bufRef;
     }
-  
-  } // iSuperFrag < nSuperFrag
-  
-  return head; // return the top of the chain
+    else {
+      tail->setNextReference(bufRef);
+      tail=bufRef;
+    }
+
+    if((iBlock==nBlock-1) && remainder!=0) {
+      nBlock++;
+      warning=true;
+    }
+
+  } // for (iBlock)
+
+  // fix case where block estimate was wrong
+  if(warning) {
+    toolbox::mem::Reference* next=head;
+    do {
+      block =(I2O_EVENT_DATA_BLOCK_MESSAGE_FRAME*)next->getDataLocation();
+      if (block->superFragmentNb==iSuperFrag)
+	block->nbBlocksInSuperFragment=nBlock;		
+    } while((next=next->getNextReference()));
+  }
 }
 
 //______________________________________________________________________________
@@ -8,6 +8,7 @@
 
 
 #include "EventFilter/AutoBU/interface/BUEvent.h"
+#include "EventFilter/AutoBU/interface/FastCopy.h"
 #include <assert.h>
 #include "FWCore/Utilities/interface/CRC16.h"
 
@@ -15,9 +16,6 @@
 #include "interface/shared/fed_trailer.h"
 
 #include <iostream>
-#include <iomanip>
-#include <fstream>
-#include <sstream>
 #include <cstring>
 
 using namespace std;
@@ -38,31 +36,39 @@ bool BUEvent::computeCrc_=true;
 ////////////////////////////////////////////////////////////////////////////////
 
 //______________________________________________________________________________
-BUEvent::BUEvent(unsigned int buResourceId,unsigned int bufferSize)
+BUEvent::BUEvent(unsigned int buResourceId,ChunkPool* pool)
   : buResourceId_(buResourceId)
   , evtNumber_(0xffffffff)
+  , evtType_(0)
   , evtSize_(0)
-  , bufferSize_(bufferSize)
+  , memSize_(0)
   , nFed_(0)
   , fedId_(0)
-  , fedPos_(0)
+  , fedAddr_(0)
   , fedSize_(0)
-  , buffer_(0)
+  , nSuperFrag_(0)
+  , sfFirstFed_(0)
+  , truncated_(false)
+  , pool_(pool)
+  , chunkPos_(0)
+  , chunkLeft_(0)
 {
-  fedId_  = new unsigned int[1024];
-  fedPos_ = new unsigned int[1024];
-  fedSize_= new unsigned int[1024];
-  buffer_ = new unsigned char[bufferSize];
+  fedId_     = new unsigned int[1024];
+  fedAddr_   = new unsigned char*[1024];
+  fedSize_   = new unsigned int[1024];
+  sfFirstFed_= new unsigned int[1024];
 }
 
 
 //______________________________________________________________________________
 BUEvent::~BUEvent()
 {
+  for (unsigned int i=0;i<chunks_.size();i++)
+    pool_->release(chunks_[i],chunkSizes_[i]);
   if (0!=fedId_)   delete [] fedId_;
-  if (0!=fedPos_)  delete [] fedPos_;
+  if (0!=fedAddr_) delete [] fedAddr_;
   if (0!=fedSize_) delete [] fedSize_;
-  if (0!=buffer_)  delete [] buffer_;
+  if (0!=sfFirstFed_) delete [] sfFirstFed_;
 }
 
 
@@ -74,28 +80,47 @@ BUEvent::~BUEvent()
 void BUEvent::initialize(unsigned int evtNumber)
  {
    evtNumber_=evtNumber & 0xFFFFFF; // 24 bits only available in the FED headers
+   evtType_=0;
    evtSize_=0;
    nFed_=0;
+   nSuperFrag_=0;
+   truncated_=false;
+   
+   // keep the first chunk if it has the default size, give the others back
+   while (chunks_.size()>1||
+	  (!chunks_.empty()&&chunkSizes_[0]>pool_->chunkSize())) {
+     pool_->release(chunks_.back(),chunkSizes_.back());
+     chunks_.pop_back();
+     chunkSizes_.pop_back();
+   }
+   chunkPos_ =chunks_.empty() ? 0 : chunks_[0];
+   chunkLeft_=chunks_.empty() ? 0 : chunkSizes_[0];
+   memSize_  =chunkLeft_;
  }
 
 
 //______________________________________________________________________________
 bool BUEvent::writeFed(unsigned int id,unsigned char* data,unsigned int size)
 {
-  if (evtSize_+size > bufferSize_) {
-    cout<<"BUEvent::writeFed() ERROR: buffer overflow."<<endl;
+  if (nFed_==1024) {
+    cout<<"BUEvent::writeFed() ERROR: too many feds (max=1024)."<<endl;
+    truncated_=true;
     return false;
   }
   
-  if (nFed_==1024) {
-    cout<<"BUEvent::writeFed() ERROR: too many feds (max=1024)."<<endl;
+  // feds are contiguous and 8 byte aligned, the pool may be exhausted
+  unsigned int alignedSize=(size+7)&~7U;
+  if (alignedSize>chunkLeft_&&!newChunk(alignedSize)) {
+    truncated_=true;
     return false;
   }
   
   fedId_[nFed_]  =id;
-  fedPos_[nFed_] =evtSize_;
+  fedAddr_[nFed_]=chunkPos_;
   fedSize_[nFed_]=size;
-  if (0!=data) memcpy(fedAddr(nFed_),data,size);
+  if (0!=data) FastCopy::copy(chunkPos_,data,size);
+  chunkPos_ +=alignedSize;
+  chunkLeft_-=alignedSize;
   ++nFed_;
   evtSize_+=size;
   return true;
@@ -113,6 +138,7 @@ bool BUEvent::writeFedHeader(unsigned int i)
   fedh_t *fedHeader=(fedh_t*)fedAddr(i);
   fedHeader->eventid =evtNumber();
   fedHeader->eventid|=0x50000000;
+  fedHeader->eventid|=(evtType_<<FED_EVTY_SHIFT)&FED_EVTY_MASK;
   fedHeader->sourceid=(fedId(i) << 8) & FED_SOID_MASK;
   
   return true;
@@ -143,30 +169,40 @@ bool BUEvent::writeFedTrailer(unsigned int i)
 
 
 //______________________________________________________________________________
-unsigned char* BUEvent::fedAddr(unsigned int i) const
+void BUEvent::startSuperFrag()
 {
-  return (buffer_+fedPos_[i]);
+  // feds written from now on go to a new super fragment, unless the
+  // current one is still empty
+  if (nSuperFrag_>0&&sfFirstFed_[nSuperFrag_-1]==nFed_) return;
+  if (nSuperFrag_==1024) return;
+  sfFirstFed_[nSuperFrag_++]=nFed_;
 }
 
 
-//________________________________________________________________________________
-void BUEvent::dump()
+//______________________________________________________________________________
+unsigned int BUEvent::nSuperFrag() const
 {
-  ostringstream oss; oss<<"/tmp/autobu_evt"<<evtNumber()<<".dump";
-  ofstream fout(oss.str().c_str());
-  fout.fill('0');
-  
-  fout<<"#\n# evt "<<evtNumber()<<"\n#\n"<<endl;
-  for (unsigned int i=0;i<nFed();i++) {
-    if (fedSize(i)==0) continue;
-    fout<<"# fedid "<<fedId(i)<<endl;
-    unsigned char* addr=fedAddr(i);
-    for (unsigned int j=0;j<fedSize(i);j++) {
-      fout<<setiosflags(ios::right)<<setw(2)<<hex<<(int)(*addr)<<dec;
-      if ((j+1)%8) fout<<" "; else fout<<endl;
-      ++addr;
-    }
-    fout<<endl;
-  }
-  fout.close();
+  // trailing super fragments without feds don't count
+  unsigned int n=nSuperFrag_;
+  while (n>0&&sfFirstFed_[n-1]==nFed_) --n;
+  return n;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// implementation of private member functions
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+bool BUEvent::newChunk(unsigned int size)
+{
+  unsigned int   chunkSize;
+  unsigned char* chunk=pool_->allocate(size,chunkSize);
+  if (0==chunk) return false;
+  chunks_.push_back(chunk);
+  chunkSizes_.push_back(chunkSize);
+  chunkPos_ =chunk;
+  chunkLeft_=chunkSize;
+  memSize_ +=chunkSize;
+  return true;
 }
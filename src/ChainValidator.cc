@@ -0,0 +1,332 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// ChainValidator
+// --------------
+//
+// Verifies sampled copies of the i2o chains built by BU::createMsgChain.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "EventFilter/AutoBU/interface/ChainValidator.h"
+#include "EventFilter/AutoBU/interface/BUEvent.h"
+
+#include "FWCore/Utilities/interface/CRC16.h"
+
+#include "interface/evb/i2oEVBMsgs.h"
+#include "interface/shared/i2oXFunctionCodes.h"
+#include "interface/shared/frl_header.h"
+#include "interface/shared/fed_header.h"
+#include "interface/shared/fed_trailer.h"
+
+#include <cstring>
+
+
+using namespace std;
+using namespace evf;
+
+
+////////////////////////////////////////////////////////////////////////////////
+// construction/destruction
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+ChainValidator::ChainValidator()
+  : buResourceId_(0)
+  , fuResourceId_(0)
+  , evtNumber_(0)
+  , nFed_(0)
+  , evtSize_(0)
+  , nFedFound_(0)
+  , evtSizeFound_(0)
+  , checkCrc_(false)
+  , busy_(false)
+  , stopping_(false)
+  , nbValidated_(0)
+  , nbErrors_(0)
+  , nbSkipped_(0)
+{
+  sem_init(&readySem_,0,0);
+  sem_init(&lock_,0,1);
+}
+
+
+//______________________________________________________________________________
+ChainValidator::~ChainValidator()
+{
+
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// implementation of member functions
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+void ChainValidator::start(bool checkCrc)
+{
+  checkCrc_   =checkCrc;
+  busy_       =false;
+  stopping_   =false;
+  nbValidated_=0;
+  nbErrors_   =0;
+  nbSkipped_  =0;
+  lock();
+  lastError_.clear();
+  unlock();
+  sem_init(&readySem_,0,0);
+}
+
+
+//______________________________________________________________________________
+bool ChainValidator::submit(toolbox::mem::Reference* head,
+			    const BUEvent* evt,
+			    unsigned int fuResourceId)
+{
+  if (stopping_) return false;
+  if (busy_) { nbSkipped_++; return false; }
+
+  frames_.clear();
+  frameSizes_.clear();
+  for (toolbox::mem::Reference* ref=head;0!=ref;ref=ref->getNextReference()) {
+    unsigned char* data=(unsigned char*)ref->getDataLocation();
+    unsigned int   size=ref->getDataSize();
+    frames_.insert(frames_.end(),data,data+size);
+    frameSizes_.push_back(size);
+  }
+
+  buResourceId_=evt->buResourceId();
+  fuResourceId_=fuResourceId;
+  evtNumber_   =evt->evtNumber();
+  nFed_        =evt->nFed();
+  evtSize_     =evt->evtSize();
+
+  busy_=true;
+  __sync_synchronize();
+  sem_post(&readySem_);
+  return true;
+}
+
+
+//______________________________________________________________________________
+bool ChainValidator::validate()
+{
+  sem_wait(&readySem_);
+  if (stopping_) return false;
+
+  ostringstream err;
+  if (!checkChain(err)) {
+    lock();
+    lastError_=err.str();
+    unlock();
+    nbErrors_++;
+  }
+  nbValidated_++;
+
+  __sync_synchronize();
+  busy_=false;
+  return true;
+}
+
+
+//______________________________________________________________________________
+void ChainValidator::stop()
+{
+  stopping_=true;
+  __sync_synchronize();
+  sem_post(&readySem_);
+}
+
+
+//______________________________________________________________________________
+string ChainValidator::lastError()
+{
+  lock();
+  string result=lastError_;
+  unlock();
+  return result;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// implementation of private member functions
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+bool ChainValidator::checkChain(ostringstream& err)
+{
+  const unsigned int msgHeaderSize=sizeof(I2O_EVENT_DATA_BLOCK_MESSAGE_FRAME);
+  const unsigned int frlHeaderSize=sizeof(frlh_t);
+
+  err<<"evt "<<evtNumber_<<": ";
+  if (frameSizes_.empty()) { err<<"empty chain"; return false; }
+
+  unsigned int nSuperFrag=0;
+  unsigned int iSuperFrag=0;
+  unsigned int nBlock    =0;
+  unsigned int iBlock    =0;
+  nFedFound_   =0;
+  evtSizeFound_=0;
+  superFrag_.clear();
+
+  const unsigned char* frame=&frames_[0];
+  for (unsigned int i=0;i<frameSizes_.size();frame+=frameSizes_[i++]) {
+    unsigned int size=frameSizes_[i];
+    const I2O_MESSAGE_FRAME* stdMsg=(const I2O_MESSAGE_FRAME*)frame;
+    const I2O_PRIVATE_MESSAGE_FRAME* pvtMsg=(const I2O_PRIVATE_MESSAGE_FRAME*)frame;
+    const I2O_EVENT_DATA_BLOCK_MESSAGE_FRAME* block=
+      (const I2O_EVENT_DATA_BLOCK_MESSAGE_FRAME*)frame;
+    const frlh_t* frlHeader=(const frlh_t*)(frame+msgHeaderSize);
+
+    err<<"frame "<<i<<": ";
+
+    // i2o message
+    if (size<msgHeaderSize+frlHeaderSize) {
+      err<<"frame size "<<size<<" too small"; return false;
+    }
+    if ((unsigned int)stdMsg->MessageSize<<2!=size) {
+      err<<"MessageSize "<<(stdMsg->MessageSize<<2)<<" != frame size "<<size;
+      return false;
+    }
+    if (stdMsg->Function!=I2O_PRIVATE_MESSAGE||
+	pvtMsg->XFunctionCode!=I2O_FU_TAKE) {
+      err<<"invalid Function/XFunctionCode "<<stdMsg->Function
+	 <<"/"<<pvtMsg->XFunctionCode;
+      return false;
+    }
+    if (block->eventNumber!=evtNumber_||
+	block->buResourceId!=buResourceId_||
+	block->fuTransactionId!=fuResourceId_) {
+      err<<"eventNumber/buResourceId/fuTransactionId "<<block->eventNumber
+	 <<"/"<<block->buResourceId<<"/"<<block->fuTransactionId
+	 <<" != "<<evtNumber_<<"/"<<buResourceId_<<"/"<<fuResourceId_;
+      return false;
+    }
+
+    // block numbering
+    if (i==0) nSuperFrag=block->nbSuperFragmentsInEvent;
+    if (block->nbSuperFragmentsInEvent!=nSuperFrag||nSuperFrag==0) {
+      err<<"nbSuperFragmentsInEvent "<<block->nbSuperFragmentsInEvent
+	 <<", expected "<<nSuperFrag;
+      return false;
+    }
+    if (iBlock==0) nBlock=block->nbBlocksInSuperFragment;
+    if (block->superFragmentNb!=iSuperFrag||
+	block->nbBlocksInSuperFragment!=nBlock||
+	block->blockNb!=iBlock) {
+      err<<"superFragmentNb/blockNb/nbBlocksInSuperFragment "
+	 <<block->superFragmentNb<<"/"<<block->blockNb<<"/"
+	 <<block->nbBlocksInSuperFragment<<", expected "
+	 <<iSuperFrag<<"/"<<iBlock<<"/"<<nBlock;
+      return false;
+    }
+    if (iSuperFrag>=nSuperFrag) {
+      err<<"more than "<<nSuperFrag<<" super fragments"; return false;
+    }
+
+    // frl header
+    unsigned int segSize=frlHeader->segsize&~FRL_LAST_SEGM;
+    bool         isLast =frlHeader->segsize&FRL_LAST_SEGM;
+    if (frlHeader->segno!=iBlock||frlHeader->trigno!=evtNumber_) {
+      err<<"FRL segno/trigno "<<frlHeader->segno<<"/"<<frlHeader->trigno;
+      return false;
+    }
+    // only the last block of a super fragment is shrunk to its segment
+    if (segSize>size-msgHeaderSize-frlHeaderSize||
+	(isLast&&segSize!=size-msgHeaderSize-frlHeaderSize)) {
+      err<<"FRL segsize "<<segSize<<" doesn't match payload "
+	 <<size-msgHeaderSize-frlHeaderSize;
+      return false;
+    }
+    if (isLast!=(iBlock==nBlock-1)) {
+      err<<"FRL_LAST_SEGM "<<(isLast ? "set" : "not set")
+	 <<" in block "<<iBlock<<" of "<<nBlock;
+      return false;
+    }
+
+    const unsigned char* payload=frame+msgHeaderSize+frlHeaderSize;
+    superFrag_.insert(superFrag_.end(),payload,payload+segSize);
+
+    // last block, check all feds of the super fragment
+    if (++iBlock==nBlock) {
+      if (!checkSuperFrag(iSuperFrag,err)) return false;
+      superFrag_.clear();
+      iBlock=0;
+      iSuperFrag++;
+    }
+    err.str("");
+    err<<"evt "<<evtNumber_<<": ";
+  }
+
+  if (iBlock!=0) {
+    err<<"chain ends in block "<<iBlock<<" of "<<nBlock
+       <<" of super fragment "<<iSuperFrag;
+    return false;
+  }
+  if (iSuperFrag!=nSuperFrag) {
+    err<<iSuperFrag<<" of "<<nSuperFrag<<" super fragments found"; return false;
+  }
+  if (nFedFound_!=nFed_||evtSizeFound_!=evtSize_) {
+    err<<nFedFound_<<" feds / "<<evtSizeFound_<<" bytes found, expected "
+       <<nFed_<<" / "<<evtSize_;
+    return false;
+  }
+  return true;
+}
+
+
+//______________________________________________________________________________
+bool ChainValidator::checkSuperFrag(unsigned int iSuperFrag,ostringstream& err)
+{
+  const unsigned int fedHeaderSize =sizeof(fedh_t);
+  const unsigned int fedTrailerSize=sizeof(fedt_t);
+
+  // only the header and trailer of each fed are touched (except for crc)
+  unsigned int pos=superFrag_.size();
+  while (pos>0) {
+    if (pos<fedHeaderSize+fedTrailerSize) {
+      err<<"super fragment "<<iSuperFrag<<": "<<pos<<" bytes left before the "
+	 <<"first fed";
+      return false;
+    }
+    fedt_t* fedTrailer=(fedt_t*)(&superFrag_[pos-fedTrailerSize]);
+    if ((fedTrailer->eventsize&FED_TCTRLID_MASK)>>FED_TCTRLID_SHIFT!=
+	FED_SLINK_END_MARKER) {
+      err<<"super fragment "<<iSuperFrag<<": no fed trailer at offset "
+	 <<pos-fedTrailerSize;
+      return false;
+    }
+    unsigned int fedSize=(fedTrailer->eventsize&FED_EVSZ_MASK)*8;
+    if (fedSize<fedHeaderSize+fedTrailerSize||fedSize>pos) {
+      err<<"super fragment "<<iSuperFrag<<": invalid fed size "<<fedSize
+	 <<" in trailer at offset "<<pos-fedTrailerSize;
+      return false;
+    }
+    pos-=fedSize;
+    fedh_t* fedHeader=(fedh_t*)(&superFrag_[pos]);
+    if ((fedHeader->eventid&FED_HCTRLID_MASK)>>FED_HCTRLID_SHIFT!=
+	FED_SLINK_START_MARKER) {
+      err<<"super fragment "<<iSuperFrag<<": no fed header at offset "<<pos
+	 <<" (fed size "<<fedSize<<")";
+      return false;
+    }
+
+    // crc was computed with the crc field set to zero, see BUEvent
+    if (checkCrc_) {
+      unsigned int   conscheck=fedTrailer->conscheck;
+      unsigned short expected =(conscheck&FED_CRCS_MASK)>>FED_CRCS_SHIFT;
+      fedTrailer->conscheck=0;
+      unsigned short crc=evf::compute_crc(&superFrag_[pos],fedSize);
+      fedTrailer->conscheck=conscheck;
+      if (crc!=expected) {
+	err<<"super fragment "<<iSuperFrag<<": fed "
+	   <<((fedHeader->sourceid&FED_SOID_MASK)>>FED_SOID_SHIFT)
+	   <<" crc 0x"<<hex<<crc<<" != 0x"<<expected<<dec;
+	return false;
+      }
+    }
+
+    nFedFound_++;
+    evtSizeFound_+=fedSize;
+  }
+  return true;
+}
@@ -0,0 +1,142 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// ChunkPool
+// ---------
+//
+// Shared memory pool for the fed data of all BUEvents, see BUEvent::writeFed.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "EventFilter/AutoBU/interface/ChunkPool.h"
+#include "EventFilter/AutoBU/interface/ThreadPlacement.h"
+
+#include <cstdlib>
+
+
+using namespace std;
+using namespace evf;
+
+
+////////////////////////////////////////////////////////////////////////////////
+// construction/destruction
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+ChunkPool::ChunkPool()
+  : chunkSize_(0x40000)
+  , maxSize_(0)
+  , used_(0)
+  , peakUsed_(0)
+  , reserved_(0)
+  , numaNode_(-1)
+  , nbNumaFailures_(0)
+  , free_(32)
+{
+  sem_init(&lock_,0,1);
+}
+
+
+//______________________________________________________________________________
+ChunkPool::~ChunkPool()
+{
+  trim();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// implementation of member functions
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+void ChunkPool::configure(unsigned int chunkSize,uint64_t maxSize,int numaNode)
+{
+  if (chunkSize!=chunkSize_||numaNode!=numaNode_) trim();
+  lock();
+  chunkSize_     =(chunkSize<8) ? 8 : chunkSize-chunkSize%8;
+  maxSize_       =maxSize;
+  numaNode_      =numaNode;
+  nbNumaFailures_=0;
+  peakUsed_      =used_;
+  unlock();
+}
+
+
+//______________________________________________________________________________
+unsigned char* ChunkPool::allocate(unsigned int size,unsigned int& chunkSize)
+{
+  unsigned int iClass=sizeClass(size);
+  if (iClass>=free_.size()) return 0;
+  chunkSize=chunkSize_<<iClass;
+
+  unsigned char* chunk=0;
+  lock();
+  if (!free_[iClass].empty()) {
+    chunk=free_[iClass].back();
+    free_[iClass].pop_back();
+  }
+  else {
+    // give chunks of other size classes back before exceeding the limit
+    if (maxSize_>0&&reserved_+chunkSize>maxSize_) {
+      unlock();
+      trim();
+      lock();
+    }
+    if (maxSize_==0||reserved_+chunkSize<=maxSize_) {
+      void* mem=0;
+      if (0==posix_memalign(&mem,4096,chunkSize)) {
+	chunk=(unsigned char*)mem;
+	reserved_+=chunkSize;
+	if (numaNode_>=0&&!ThreadPlacement::bindMemory(chunk,chunkSize,numaNode_))
+	  nbNumaFailures_++;
+      }
+    }
+  }
+  if (0!=chunk) {
+    used_+=chunkSize;
+    if (used_>peakUsed_) peakUsed_=used_;
+  }
+  unlock();
+
+  return chunk;
+}
+
+
+//______________________________________________________________________________
+void ChunkPool::release(unsigned char* chunk,unsigned int chunkSize)
+{
+  if (0==chunk) return;
+  unsigned int iClass=sizeClass(chunkSize);
+  lock();
+  free_[iClass].push_back(chunk);
+  used_-=chunkSize;
+  unlock();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// implementation of private member functions
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+unsigned int ChunkPool::sizeClass(unsigned int size) const
+{
+  unsigned int iClass=0;
+  uint64_t     classSize=chunkSize_;
+  while (classSize<size) { classSize<<=1; iClass++; }
+  return iClass;
+}
+
+
+//______________________________________________________________________________
+void ChunkPool::trim()
+{
+  lock();
+  for (unsigned int i=0;i<free_.size();i++) {
+    while (!free_[i].empty()) {
+      free(free_[i].back());
+      reserved_-=(uint64_t)chunkSize_<<i;
+      free_[i].pop_back();
+    }
+  }
+  unlock();
+}
@@ -0,0 +1,137 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// CrcPatch
+// --------
+//
+// Incremental update of the fed trailer crc after rewriting header fields.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "EventFilter/AutoBU/interface/CrcPatch.h"
+
+#include "FWCore/Utilities/interface/CRC16.h"
+
+#include "interface/shared/fed_trailer.h"
+
+#include <cstring>
+
+
+using namespace std;
+using namespace evf;
+
+
+namespace {
+
+  // product of the 16x16 matrix given by its columns and v
+  inline unsigned short multiply(const unsigned short* columns,unsigned short v)
+  {
+    unsigned short result=0;
+    for (unsigned int i=0;v!=0;i++,v>>=1)
+      if (v&1) result^=columns[i];
+    return result;
+  }
+
+} // namespace
+
+
+////////////////////////////////////////////////////////////////////////////////
+// construction/destruction
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+CrcPatch::CrcPatch()
+{
+  // the crc of one word is affine in its bits: single bits give the
+  // columns, any byte value is the sum of its bits
+  unsigned char word[8];
+  memset(word,0,sizeof(word));
+  unsigned short crcOfZero=evf::compute_crc(word,sizeof(word));
+  for (unsigned int j=0;j<8;j++) {
+    unsigned short bit[8];
+    for (unsigned int b=0;b<8;b++) {
+      word[j]=1<<b;
+      bit[b]=evf::compute_crc(word,sizeof(word))^crcOfZero;
+    }
+    word[j]=0;
+    for (unsigned int v=0;v<256;v++) {
+      wordTable_[j][v]=0;
+      for (unsigned int b=0;b<8;b++) if (v&(1<<b)) wordTable_[j][v]^=bit[b];
+    }
+  }
+
+  // one zero word: eight zero bytes, which is linear in the crc
+  unsigned short columns[16],square[16];
+  for (unsigned int i=0;i<16;i++) {
+    unsigned short crc=1<<i;
+    for (unsigned int j=0;j<8;j++) crc=evf::compute_crc_8bit(crc,0);
+    columns[i]=crc;
+  }
+  for (unsigned int p=0;p<32;p++) {
+    for (unsigned int v=0;v<256;v++) {
+      zeroWords_[p][0][v]=multiply(columns,v);
+      zeroWords_[p][1][v]=multiply(columns,v<<8);
+    }
+    for (unsigned int i=0;i<16;i++)
+      square[i]=multiply(columns,multiply(columns,1<<i));
+    memcpy(columns,square,sizeof(columns));
+  }
+}
+
+
+//______________________________________________________________________________
+CrcPatch::~CrcPatch()
+{
+
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// implementation of member functions
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+bool CrcPatch::write(unsigned char* fedAddr,unsigned int fedSize,
+		     unsigned int offset,const void* data,unsigned int n) const
+{
+  const unsigned char* bytes=(const unsigned char*)data;
+  if (fedSize%8!=0||fedSize<sizeof(fedt_t)||
+      offset+n>fedSize-sizeof(fedt_t)) {
+    memcpy(fedAddr+offset,bytes,n);
+    return false;
+  }
+
+  unsigned short crc=0;
+  unsigned int   nWords=fedSize/8;
+  unsigned int   end=offset+n;
+  for (unsigned int word=offset/8;word*8<end;word++) {
+    unsigned char delta[8];
+    memset(delta,0,sizeof(delta));
+    for (unsigned int i=0;i<8;i++) {
+      unsigned int pos=word*8+i;
+      if (pos<offset||pos>=end) continue;
+      delta[i]=fedAddr[pos]^bytes[pos-offset];
+      fedAddr[pos]=bytes[pos-offset];
+    }
+    crc^=contribution(delta,nWords-1-word);
+  }
+
+  fedt_t* fedTrailer=(fedt_t*)(fedAddr+fedSize-sizeof(fedt_t));
+  fedTrailer->conscheck^=((unsigned int)crc<<FED_CRCS_SHIFT)&FED_CRCS_MASK;
+  return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// implementation of private member functions
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+unsigned short CrcPatch::contribution(const unsigned char* delta,
+				      unsigned int nWords) const
+{
+  unsigned short crc=0;
+  for (unsigned int j=0;j<8;j++) crc^=wordTable_[j][delta[j]];
+  for (unsigned int p=0;nWords!=0&&crc!=0;p++,nWords>>=1)
+    if (nWords&1) crc=zeroWords_[p][0][crc&0xff]^zeroWords_[p][1][crc>>8];
+  return crc;
+}
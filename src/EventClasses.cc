@@ -0,0 +1,195 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// EventClasses
+// ------------
+//
+// Weighted mix of event classes (physics, calibration, empty, ...) generated
+// in RANDOM mode.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "EventFilter/AutoBU/interface/EventClasses.h"
+
+#include "DataFormats/FEDRawData/interface/FEDNumbering.h"
+
+#include "interface/shared/fed_header.h"
+#include "interface/shared/fed_trailer.h"
+
+#include <sstream>
+#include <cctype>
+#include <cstdlib>
+#include <cmath>
+
+
+using namespace std;
+using namespace evf;
+
+
+namespace {
+
+  const unsigned int maxFedId=FEDNumbering::MAXFEDID;
+
+} // namespace
+
+
+////////////////////////////////////////////////////////////////////////////////
+// construction/destruction
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+EventClasses::EventClasses()
+{
+
+}
+
+
+//______________________________________________________________________________
+EventClasses::~EventClasses()
+{
+
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// implementation of member functions
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+bool EventClasses::configure(const string& spec,string& error)
+{
+  vector<EventClass> classes;
+  double             sumOfWeights=0.0;
+
+  istringstream iss(spec);
+  string entry;
+  while (getline(iss,entry,';')) {
+    // strip blanks
+    string tmp;
+    for (unsigned int i=0;i<entry.size();i++)
+      if (!isspace(entry[i])) tmp+=entry[i];
+    entry=tmp;
+    if (entry.empty()) continue;
+
+    vector<string> fields;
+    istringstream fss(entry);
+    string field;
+    while (getline(fss,field,':')) fields.push_back(field);
+    if (fields.size()<4||fields.size()>6||fields[0].empty()) {
+      error="invalid event class '"+entry+"', expected "
+	"<name>:<weight>:<feds>:<mean>[:<width>[:<evtType>]]";
+      return false;
+    }
+
+    EventClass evtClass;
+    evtClass.name=fields[0];
+    char* end=0;
+    evtClass.weight=strtod(fields[1].c_str(),&end);
+    if (*end!='\0'||fields[1].empty()||evtClass.weight<0.0) {
+      error="invalid weight in '"+entry+"'"; return false;
+    }
+    if (!parseFedList(fields[2],evtClass.feds)) {
+      error="invalid fed list '"+fields[2]+"'"; return false;
+    }
+
+    unsigned int fedSizeMin=sizeof(fedh_t)+sizeof(fedt_t);
+    evtClass.fedSizeMean=strtoul(fields[3].c_str(),&end,10);
+    if (*end!='\0'||evtClass.fedSizeMean<fedSizeMin||
+	evtClass.fedSizeMean%8!=0) {
+      error="invalid fed size in '"+entry+"', must be a multiple of 8 >= 16";
+      return false;
+    }
+    evtClass.fedSizeWidth=0;
+    if (fields.size()>4&&!fields[4].empty()) {
+      evtClass.fedSizeWidth=strtoul(fields[4].c_str(),&end,10);
+      if (*end!='\0') { error="invalid width in '"+entry+"'"; return false; }
+    }
+    evtClass.evtType=1;
+    if (fields.size()>5) {
+      evtClass.evtType=strtoul(fields[5].c_str(),&end,10);
+      if (*end!='\0'||fields[5].empty()||
+	  evtClass.evtType>(FED_EVTY_MASK>>FED_EVTY_SHIFT)) {
+	error="invalid evtType in '"+entry+"'"; return false;
+      }
+    }
+
+    // log-normal parameters, as for the global fed size distribution
+    double mean =evtClass.fedSizeMean;
+    double width=evtClass.fedSizeWidth;
+    evtClass.gaussianMean =std::log(mean);
+    evtClass.gaussianWidth=std::sqrt(std::log(0.5*(1+std::sqrt(1.0+4.0*width*width/mean/mean))));
+
+    sumOfWeights+=evtClass.weight;
+    classes.push_back(evtClass);
+  }
+  if (!classes.empty()&&sumOfWeights<=0.0) {
+    error="the sum of the event class weights must be positive";
+    return false;
+  }
+
+  // alias tables: each bin i is kept with probability prob[i], else
+  // its alias is taken
+  unsigned int         n=classes.size();
+  vector<double>       prob(n);
+  vector<unsigned int> alias(n);
+  vector<unsigned int> small,large;
+  for (unsigned int i=0;i<n;i++) {
+    prob[i]=classes[i].weight*n/sumOfWeights;
+    alias[i]=i;
+    if (prob[i]<1.0) small.push_back(i); else large.push_back(i);
+  }
+  while (!small.empty()&&!large.empty()) {
+    unsigned int s=small.back(); small.pop_back();
+    unsigned int l=large.back();
+    alias[s]=l;
+    prob[l]-=1.0-prob[s];
+    if (prob[l]<1.0) { large.pop_back(); small.push_back(l); }
+  }
+  // left-overs are 1 up to rounding
+  for (unsigned int i=0;i<small.size();i++) prob[small[i]]=1.0;
+  for (unsigned int i=0;i<large.size();i++) prob[large[i]]=1.0;
+
+  classes_.swap(classes);
+  prob_.swap(prob);
+  alias_.swap(alias);
+  return true;
+}
+
+
+//______________________________________________________________________________
+unsigned int EventClasses::sample(double u) const
+{
+  double       x=u*prob_.size();
+  unsigned int i=(unsigned int)x;
+  if (i>=prob_.size()) i=prob_.size()-1;
+  return (x-i<prob_[i]) ? i : alias_[i];
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// implementation of private member functions
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+bool EventClasses::parseFedList(const string& fedList,vector<bool>& feds)
+{
+  if (fedList=="*") { feds.assign(maxFedId+1,true); return true; }
+
+  feds.assign(maxFedId+1,false);
+  istringstream iss(fedList);
+  string range;
+  while (getline(iss,range,',')) {
+    if (range.empty()) continue;
+    char* end=0;
+    unsigned long first=strtoul(range.c_str(),&end,10);
+    unsigned long last =first;
+    if (end==range.c_str()) return false;
+    if (*end=='-') {
+      const char* begin=end+1;
+      last=strtoul(begin,&end,10);
+      if (end==begin) return false;
+    }
+    if (*end!='\0'||last<first||last>maxFedId) return false;
+    for (unsigned long id=first;id<=last;id++) feds[id]=true;
+  }
+  return true;
+}
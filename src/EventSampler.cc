@@ -0,0 +1,271 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// EventSampler
+// ------------
+//
+// Sampled events are copied by the builder into a ring buffer and written
+// to disk in a compact binary format by a separate thread.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "EventFilter/AutoBU/interface/EventSampler.h"
+#include "EventFilter/AutoBU/interface/BUEvent.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+using namespace std;
+using namespace evf;
+
+
+////////////////////////////////////////////////////////////////////////////////
+// initialize static member data
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+const char* EventSampler::fileMagic_ ="AUTOBUSP";
+const char* EventSampler::indexMagic_="AUTOBUIX";
+
+
+////////////////////////////////////////////////////////////////////////////////
+// construction/destruction
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+EventSampler::EventSampler()
+  : fd_(-1)
+  , buffer_(0)
+  , bufferSize_(0)
+  , head_(0)
+  , tail_(0)
+  , closing_(false)
+  , prescale_(0)
+  , minEvtSize_(0)
+  , nbSeen_(0)
+  , nbSampled_(0)
+  , nbDropped_(0)
+  , nbWritten_(0)
+  , bytesWritten_(0)
+{
+  sem_init(&dataSem_,0,0);
+}
+
+
+//______________________________________________________________________________
+EventSampler::~EventSampler()
+{
+  if (fd_>=0)     ::close(fd_);
+  if (0!=buffer_) delete [] buffer_;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// implementation of member functions
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+bool EventSampler::open(const string& fileName,
+			unsigned int bufferSize,
+			unsigned int prescale,
+			unsigned int minEvtSize)
+{
+  if (fd_>=0) ::close(fd_);
+  fd_=::open(fileName.c_str(),O_WRONLY|O_CREAT|O_TRUNC,0644);
+  if (fd_<0) {
+    cout<<"EventSampler::open() ERROR: can't open "<<fileName<<": "
+	<<strerror(errno)<<endl;
+    return false;
+  }
+  fileName_=fileName;
+
+  bufferSize-=bufferSize%8;
+  if (bufferSize!=bufferSize_) {
+    if (0!=buffer_) delete [] buffer_;
+    buffer_    =new unsigned char[bufferSize];
+    bufferSize_=bufferSize;
+  }
+
+  head_        =0;
+  tail_        =0;
+  closing_     =false;
+  prescale_    =prescale;
+  minEvtSize_  =minEvtSize;
+  nbSeen_      =0;
+  nbSampled_   =0;
+  nbDropped_   =0;
+  nbWritten_   =0;
+  bytesWritten_=0;
+  index_.clear();
+  sem_init(&dataSem_,0,0);
+
+  uint32_t header[4];
+  memcpy(header,fileMagic_,8);
+  header[2]=version_;
+  header[3]=0;
+  if (::write(fd_,header,sizeof(header))!=(ssize_t)sizeof(header)) {
+    cout<<"EventSampler::open() ERROR: can't write "<<fileName<<endl;
+    ::close(fd_);
+    fd_=-1;
+    return false;
+  }
+  bytesWritten_=sizeof(header);
+
+  return true;
+}
+
+
+//______________________________________________________________________________
+bool EventSampler::sample(const BUEvent* evt)
+{
+  if (fd_<0||closing_) return false;
+
+  ++nbSeen_;
+  bool sampled=(prescale_>0&&nbSeen_%prescale_==0)||
+    (minEvtSize_>0&&evt->evtSize()>=minEvtSize_);
+  if (!sampled) return false;
+
+  uint64_t recordSize=4*sizeof(uint32_t)+2*sizeof(uint32_t)*evt->nFed();
+  for (unsigned int i=0;i<evt->nFed();i++) recordSize+=(evt->fedSize(i)+7)&~7U;
+
+  // records are contiguous, leave a zero marker and wrap if needed
+  __sync_synchronize();
+  uint64_t head  =head_;
+  uint64_t tail  =tail_;
+  uint64_t offset=head%bufferSize_;
+  uint64_t skip  =(offset+recordSize>bufferSize_) ? bufferSize_-offset : 0;
+  if (recordSize>bufferSize_||head+skip+recordSize-tail>bufferSize_) {
+    nbDropped_++;
+    return false;
+  }
+  if (skip>0) {
+    *(uint32_t*)(buffer_+offset)=0;
+    head  +=skip;
+    offset =0;
+  }
+
+  uint32_t* header=(uint32_t*)(buffer_+offset);
+  header[0]=recordSize;
+  header[1]=evt->evtNumber();
+  header[2]=evt->nFed();
+  header[3]=evt->evtSize();
+  uint32_t* fedTable=header+4;
+  for (unsigned int i=0;i<evt->nFed();i++) {
+    fedTable[2*i]  =evt->fedId(i);
+    fedTable[2*i+1]=evt->fedSize(i);
+  }
+  unsigned char* data=(unsigned char*)(fedTable+2*evt->nFed());
+  for (unsigned int i=0;i<evt->nFed();i++) {
+    memcpy(data,evt->fedAddr(i),evt->fedSize(i));
+    data+=(evt->fedSize(i)+7)&~7U;
+  }
+
+  __sync_synchronize();
+  head_=head+recordSize;
+  nbSampled_++;
+  sem_post(&dataSem_);
+
+  return true;
+}
+
+
+//______________________________________________________________________________
+bool EventSampler::write()
+{
+  sem_wait(&dataSem_);
+
+  for (;;) {
+    __sync_synchronize();
+    uint64_t head=head_;
+    uint64_t tail=tail_;
+    if (tail==head) break;
+
+    // write all records up to the end of the buffer at once
+    uint64_t end=std::min(head,tail+bufferSize_-tail%bufferSize_);
+    uint64_t pos=tail;
+    while (pos<end) {
+      uint32_t* header=(uint32_t*)(buffer_+pos%bufferSize_);
+      if (header[0]==0) break;
+      IndexEntry entry;
+      entry.evtNumber =header[1];
+      entry.recordSize=header[0];
+      entry.offset    =bytesWritten_+(pos-tail);
+      index_.push_back(entry);
+      nbWritten_++;
+      pos+=header[0];
+    }
+    if (pos>tail&&!writeSpan(tail,pos)) {
+      // keep consuming, but don't write anymore
+      ::close(fd_);
+      fd_=-1;
+    }
+
+    __sync_synchronize();
+    tail_=(pos<end) ? end : pos;
+  }
+
+  if (closing_) {
+    finish();
+    return false;
+  }
+  return true;
+}
+
+
+//______________________________________________________________________________
+void EventSampler::close()
+{
+  closing_=true;
+  __sync_synchronize();
+  sem_post(&dataSem_);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// implementation of private member functions
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+bool EventSampler::writeSpan(uint64_t begin,uint64_t end)
+{
+  if (fd_<0) return false;
+
+  unsigned char* data=buffer_+begin%bufferSize_;
+  uint64_t       left=end-begin;
+  while (left>0) {
+    ssize_t n=::write(fd_,data,left);
+    if (n<0) {
+      if (errno==EINTR) continue;
+      cout<<"EventSampler::write() ERROR: "<<strerror(errno)<<endl;
+      return false;
+    }
+    data+=n;
+    left-=n;
+  }
+  bytesWritten_+=end-begin;
+  return true;
+}
+
+
+//______________________________________________________________________________
+void EventSampler::finish()
+{
+  if (fd_<0) return;
+
+  uint64_t footer[3];
+  footer[0]=bytesWritten_;
+  footer[1]=index_.size();
+  memcpy(&footer[2],indexMagic_,8);
+
+  ssize_t indexSize=index_.size()*sizeof(IndexEntry);
+  if ((indexSize>0&&::write(fd_,&index_[0],indexSize)!=indexSize)||
+      ::write(fd_,footer,sizeof(footer))!=(ssize_t)sizeof(footer))
+    cout<<"EventSampler::finish() ERROR: can't write index to "<<fileName_<<endl;
+
+  ::close(fd_);
+  fd_=-1;
+}
@@ -0,0 +1,174 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// FUTrace
+// -------
+//
+// Records the requests and discards of the FU, or plays them back.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "EventFilter/AutoBU/interface/FUTrace.h"
+
+#include <cstring>
+#include <cerrno>
+
+
+using namespace std;
+using namespace evf;
+
+
+////////////////////////////////////////////////////////////////////////////////
+// initialize static member data
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+const char* FUTrace::magic_="AUTOBUFT";
+
+
+////////////////////////////////////////////////////////////////////////////////
+// construction/destruction
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+FUTrace::FUTrace()
+  : file_(0)
+  , replayPos_(0)
+  , nbRecords_(0)
+{
+  sem_init(&lock_,0,1);
+}
+
+
+//______________________________________________________________________________
+FUTrace::~FUTrace()
+{
+  close();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// implementation of member functions
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+bool FUTrace::openRecord(const string& fileName)
+{
+  close();
+  FILE* file=fopen(fileName.c_str(),"wb");
+  if (0==file) {
+    error_="can't open "+fileName+": "+strerror(errno);
+    return false;
+  }
+  // keep the writes out of the i2o callbacks most of the time
+  setvbuf(file,0,_IOFBF,0x100000);
+
+  uint32_t header[4];
+  memcpy(header,magic_,8);
+  header[2]=version_;
+  header[3]=0;
+  if (fwrite(header,sizeof(header),1,file)!=1) {
+    error_="can't write "+fileName;
+    fclose(file);
+    return false;
+  }
+
+  lock();
+  gettimeofday(&start_,0);
+  nbRecords_=0;
+  file_     =file;
+  unlock();
+  return true;
+}
+
+
+//______________________________________________________________________________
+void FUTrace::record(RecordType type,const unsigned int* ids,unsigned int n)
+{
+  struct timeval now;
+  gettimeofday(&now,0);
+
+  lock();
+  if (0!=file_) {
+    uint64_t timeUs=(uint64_t)(now.tv_sec-start_.tv_sec)*1000000+
+      (now.tv_usec-start_.tv_usec);
+    uint32_t typeAndN=((uint32_t)type<<24)|(n&0xffffff);
+    fwrite(&timeUs,sizeof(timeUs),1,file_);
+    fwrite(&typeAndN,sizeof(typeAndN),1,file_);
+    for (unsigned int i=0;i<n;i++) {
+      uint32_t id=ids[i];
+      fwrite(&id,sizeof(id),1,file_);
+    }
+    nbRecords_++;
+  }
+  unlock();
+}
+
+
+//______________________________________________________________________________
+bool FUTrace::openReplay(const string& fileName)
+{
+  close();
+  FILE* file=fopen(fileName.c_str(),"rb");
+  if (0==file) {
+    error_="can't open "+fileName+": "+strerror(errno);
+    return false;
+  }
+
+  replay_.clear();
+  unsigned char buffer[0x10000];
+  size_t n;
+  while ((n=fread(buffer,1,sizeof(buffer),file))>0)
+    replay_.insert(replay_.end(),buffer,buffer+n);
+  fclose(file);
+
+  if (replay_.size()<16||0!=memcmp(&replay_[0],magic_,8)) {
+    error_=fileName+" is not an FU trace";
+    replay_.clear();
+    return false;
+  }
+  uint32_t version;
+  memcpy(&version,&replay_[8],sizeof(version));
+  if (version!=version_) {
+    error_=fileName+" has an unknown trace version";
+    replay_.clear();
+    return false;
+  }
+
+  replayPos_=16;
+  nbRecords_=0;
+  return true;
+}
+
+
+//______________________________________________________________________________
+bool FUTrace::next(Record& record)
+{
+  const size_t recordHeaderSize=sizeof(uint64_t)+sizeof(uint32_t);
+  if (replayPos_+recordHeaderSize>replay_.size()) return false;
+
+  uint32_t typeAndN;
+  memcpy(&record.timeUs,&replay_[replayPos_],sizeof(uint64_t));
+  memcpy(&typeAndN,&replay_[replayPos_+sizeof(uint64_t)],sizeof(uint32_t));
+  unsigned int n=typeAndN&0xffffff;
+  if (replayPos_+recordHeaderSize+n*sizeof(uint32_t)>replay_.size()) return false;
+
+  record.type=(RecordType)(typeAndN>>24);
+  record.ids.resize(n);
+  if (n>0) memcpy(&record.ids[0],&replay_[replayPos_+recordHeaderSize],
+		  n*sizeof(uint32_t));
+  replayPos_+=recordHeaderSize+n*sizeof(uint32_t);
+  nbRecords_++;
+  return true;
+}
+
+
+//______________________________________________________________________________
+void FUTrace::close()
+{
+  lock();
+  if (0!=file_) fclose(file_);
+  file_=0;
+  unlock();
+  replay_.clear();
+  replayPos_=0;
+}
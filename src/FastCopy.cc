@@ -0,0 +1,158 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// FastCopy
+// --------
+//
+// Bulk copies with non-temporal stores, dispatched at run time.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "EventFilter/AutoBU/interface/FastCopy.h"
+
+#include <stdint.h>
+
+
+// __builtin_cpu_supports("avx512f") needs gcc 5
+#if defined(__x86_64__)&&defined(__GNUC__)&&__GNUC__>=5
+#define FASTCOPY_X86 1
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
+
+
+using namespace std;
+using namespace evf;
+
+
+namespace {
+
+  void memcpyCopy(void* dst,const void* src,size_t n)
+  {
+    memcpy(dst,src,n);
+  }
+
+#ifdef FASTCOPY_X86
+
+  // the cpu may support AVX(-512) while the kernel doesn't save the ymm / zmm
+  // registers, which __builtin_cpu_supports() doesn't check: ask XCR0
+  bool osSavesState(uint64_t mask)
+  {
+    unsigned int eax,ebx,ecx,edx;
+    if (!__get_cpuid(1,&eax,&ebx,&ecx,&edx)||0==(ecx&bit_OSXSAVE)) return false;
+    unsigned int xcr0Lo,xcr0Hi;
+    __asm__ __volatile__("xgetbv" : "=a"(xcr0Lo),"=d"(xcr0Hi) : "c"(0));
+    uint64_t xcr0=((uint64_t)xcr0Hi<<32)|xcr0Lo;
+    return (xcr0&mask)==mask;
+  }
+
+  // the head up to the first aligned destination and the tail are copied
+  // with memcpy, the stores are fenced before returning since the buffers
+  // are handed over to other threads
+
+  __attribute__((target("sse2")))
+  void streamCopySse2(void* dst,const void* src,size_t n)
+  {
+    unsigned char*       d=(unsigned char*)dst;
+    const unsigned char* s=(const unsigned char*)src;
+    size_t head=(-(uintptr_t)d)&15;
+    memcpy(d,s,head); d+=head; s+=head; n-=head;
+    for (;n>=64;n-=64,d+=64,s+=64) {
+      __m128i a=_mm_loadu_si128((const __m128i*)s);
+      __m128i b=_mm_loadu_si128((const __m128i*)(s+16));
+      __m128i c=_mm_loadu_si128((const __m128i*)(s+32));
+      __m128i e=_mm_loadu_si128((const __m128i*)(s+48));
+      _mm_stream_si128((__m128i*)d,a);
+      _mm_stream_si128((__m128i*)(d+16),b);
+      _mm_stream_si128((__m128i*)(d+32),c);
+      _mm_stream_si128((__m128i*)(d+48),e);
+    }
+    memcpy(d,s,n);
+    _mm_sfence();
+  }
+
+  __attribute__((target("avx2")))
+  void streamCopyAvx2(void* dst,const void* src,size_t n)
+  {
+    unsigned char*       d=(unsigned char*)dst;
+    const unsigned char* s=(const unsigned char*)src;
+    size_t head=(-(uintptr_t)d)&31;
+    memcpy(d,s,head); d+=head; s+=head; n-=head;
+    for (;n>=128;n-=128,d+=128,s+=128) {
+      __m256i a=_mm256_loadu_si256((const __m256i*)s);
+      __m256i b=_mm256_loadu_si256((const __m256i*)(s+32));
+      __m256i c=_mm256_loadu_si256((const __m256i*)(s+64));
+      __m256i e=_mm256_loadu_si256((const __m256i*)(s+96));
+      _mm256_stream_si256((__m256i*)d,a);
+      _mm256_stream_si256((__m256i*)(d+32),b);
+      _mm256_stream_si256((__m256i*)(d+64),c);
+      _mm256_stream_si256((__m256i*)(d+96),e);
+    }
+    memcpy(d,s,n);
+    _mm_sfence();
+  }
+
+  __attribute__((target("avx512f")))
+  void streamCopyAvx512(void* dst,const void* src,size_t n)
+  {
+    unsigned char*       d=(unsigned char*)dst;
+    const unsigned char* s=(const unsigned char*)src;
+    size_t head=(-(uintptr_t)d)&63;
+    memcpy(d,s,head); d+=head; s+=head; n-=head;
+    for (;n>=256;n-=256,d+=256,s+=256) {
+      __m512i a=_mm512_loadu_si512((const void*)s);
+      __m512i b=_mm512_loadu_si512((const void*)(s+64));
+      __m512i c=_mm512_loadu_si512((const void*)(s+128));
+      __m512i e=_mm512_loadu_si512((const void*)(s+192));
+      _mm512_stream_si512((__m512i*)d,a);
+      _mm512_stream_si512((__m512i*)(d+64),b);
+      _mm512_stream_si512((__m512i*)(d+128),c);
+      _mm512_stream_si512((__m512i*)(d+192),e);
+    }
+    memcpy(d,s,n);
+    _mm_sfence();
+  }
+
+#endif
+
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// initialize static member data
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+void      (*FastCopy::streamCopy_)(void*,const void*,size_t)=memcpyCopy;
+size_t      FastCopy::threshold_ =0;
+const char* FastCopy::kernelName_="memcpy";
+
+
+////////////////////////////////////////////////////////////////////////////////
+// implementation of member functions
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+void FastCopy::configure(size_t threshold)
+{
+  streamCopy_=memcpyCopy;
+  kernelName_="memcpy";
+#ifdef FASTCOPY_X86
+  // below the widest alignment step plus one unrolled loop, not worth it
+  if (threshold>0&&threshold<512) threshold=512;
+  __builtin_cpu_init();
+  // XCR0: sse (bit 1) and avx (bit 2) state, plus opmask / zmm (bits 5-7)
+  if (__builtin_cpu_supports("avx512f")&&osSavesState(0xe6)) {
+    streamCopy_=streamCopyAvx512;
+    kernelName_="avx512";
+  }
+  else if (__builtin_cpu_supports("avx2")&&osSavesState(0x06)) {
+    streamCopy_=streamCopyAvx2;
+    kernelName_="avx2";
+  }
+  else {
+    streamCopy_=streamCopySse2;
+    kernelName_="sse2";
+  }
+#endif
+  threshold_=threshold;
+}
@@ -0,0 +1,134 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// GeneratorConfig
+// ---------------
+//
+// Event generation parameters swapped in between events while enabled.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "EventFilter/AutoBU/interface/GeneratorConfig.h"
+
+#include <sstream>
+#include <cmath>
+#include <unistd.h>
+
+
+using namespace std;
+using namespace evf;
+
+
+////////////////////////////////////////////////////////////////////////////////
+// construction/destruction
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+GeneratorConfig::GeneratorConfig()
+  : current_(0)
+  , readSlot_(-1)
+  , version_(0)
+{
+  for (unsigned int i=0;i<2;i++) {
+    slots_[i].fedSizeMean  =1024;
+    slots_[i].fedSizeWidth =1024;
+    slots_[i].fedSizeMax   =65536;
+    slots_[i].fixedFedSize =false;
+    slots_[i].crc          =true;
+    slots_[i].targetRate   =0.0;
+    slots_[i].gaussianMean =0.0;
+    slots_[i].gaussianWidth=1.0;
+    slots_[i].version      =0;
+  }
+  sem_init(&lock_,0,1);
+}
+
+
+//______________________________________________________________________________
+GeneratorConfig::~GeneratorConfig()
+{
+
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// implementation of member functions
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+bool GeneratorConfig::complete(Settings& settings,string& error)
+{
+  ostringstream oss;
+  if (settings.fedSizeMean==0||settings.fedSizeMean>settings.fedSizeMax) {
+    oss<<"invalid fedSizeMean "<<settings.fedSizeMean<<" (fedSizeMax "
+       <<settings.fedSizeMax<<")";
+    error=oss.str();
+    return false;
+  }
+  if (settings.targetRate<0.0) {
+    oss<<"invalid targetRate "<<settings.targetRate;
+    error=oss.str();
+    return false;
+  }
+
+  // parameters of the log-normal fed size distribution (a la Emilio)
+  double mean =settings.fedSizeMean;
+  double width=settings.fedSizeWidth;
+  settings.gaussianMean =std::log(mean);
+  settings.gaussianWidth=std::sqrt(std::log(0.5*(1+std::sqrt(1.0+4.0*width*width/mean/mean))));
+  return true;
+}
+
+
+//______________________________________________________________________________
+unsigned int GeneratorConfig::publish(const Settings& settings)
+{
+  lock();
+  int spare=1-current_;
+
+  // the builder may still generate an event from the spare copy, if it
+  // acquired it before the previous flip; it sees the flip at its next
+  // acquire, see there
+  __sync_synchronize();
+  while (readSlot_==spare) ::usleep(10);
+
+  slots_[spare]=settings;
+  slots_[spare].version=version_+1;
+  __sync_synchronize();
+  current_=spare;
+  version_=version_+1;
+  unsigned int result=version_;
+  unlock();
+  return result;
+}
+
+
+//______________________________________________________________________________
+void GeneratorConfig::current(Settings& settings)
+{
+  lock();
+  settings=slots_[current_];
+  unlock();
+}
+
+
+//______________________________________________________________________________
+const GeneratorConfig::Settings& GeneratorConfig::acquire()
+{
+  // announce the slot, then check it is still current: either the writer
+  // sees readSlot_ and waits, or we see its flip and take the other slot
+  int slot;
+  do {
+    slot=current_;
+    readSlot_=slot;
+    __sync_synchronize();
+  } while (slot!=current_);
+  return slots_[slot];
+}
+
+
+//______________________________________________________________________________
+void GeneratorConfig::release()
+{
+  __sync_synchronize();
+  readSlot_=-1;
+}
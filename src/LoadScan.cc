@@ -0,0 +1,205 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// LoadScan
+// --------
+//
+// Fed size / rate scan to find the saturation point of the FU.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "EventFilter/AutoBU/interface/LoadScan.h"
+
+#include <sstream>
+#include <cctype>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+
+using namespace std;
+using namespace evf;
+
+
+////////////////////////////////////////////////////////////////////////////////
+// construction/destruction
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+LoadScan::LoadScan()
+  : minStepSec_(0)
+  , maxStepSec_(0)
+  , steadyIntervals_(0)
+  , tolerance_(0.0)
+  , active_(false)
+  , iStep_(0)
+  , stepSeconds_(0.0)
+{
+  sem_init(&lock_,0,1);
+}
+
+
+//______________________________________________________________________________
+LoadScan::~LoadScan()
+{
+
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// implementation of member functions
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+bool LoadScan::configure(const string& schedule,
+			 unsigned int minStepSec,unsigned int maxStepSec,
+			 unsigned int steadyIntervals,double tolerance,
+			 string& error)
+{
+  vector<Step> steps;
+
+  istringstream iss(schedule);
+  string entry;
+  while (getline(iss,entry,';')) {
+    // strip blanks
+    string tmp;
+    for (unsigned int i=0;i<entry.size();i++)
+      if (!isspace(entry[i])) tmp+=entry[i];
+    entry=tmp;
+    if (entry.empty()) continue;
+
+    Step step;
+    char* end=0;
+    step.fedSize=strtoul(entry.c_str(),&end,10);
+    step.rate   =0.0;
+    if (*end=='@') {
+      const char* begin=end+1;
+      step.rate=strtod(begin,&end);
+      if (end==begin||step.rate<0.0) {
+	error="invalid rate in scan step '"+entry+"'"; return false;
+      }
+    }
+    if (*end!='\0'||step.fedSize%8!=0) {
+      error="invalid scan step '"+entry+"', expected <fedSize>[@<rateHz>] "
+	"with a fed size multiple of 8";
+      return false;
+    }
+    steps.push_back(step);
+  }
+  if (!steps.empty()&&(steadyIntervals==0||maxStepSec<minStepSec)) {
+    error="scan needs steadyIntervals>0 and maxStepSec>=minStepSec";
+    return false;
+  }
+
+  steps_.swap(steps);
+  minStepSec_     =minStepSec;
+  maxStepSec_     =maxStepSec;
+  steadyIntervals_=steadyIntervals;
+  tolerance_      =tolerance;
+  active_         =false;
+  iStep_          =0;
+  return true;
+}
+
+
+//______________________________________________________________________________
+void LoadScan::start()
+{
+  lock();
+  results_.clear();
+  unlock();
+  intervals_.clear();
+  iStep_      =0;
+  stepSeconds_=0.0;
+  active_     =!steps_.empty();
+}
+
+
+//______________________________________________________________________________
+bool LoadScan::update(const MonitorHistory::Entry& entry)
+{
+  if (!active_) return false;
+
+  stepSeconds_+=entry.deltaT;
+  intervals_.push_back(entry);
+  if (intervals_.size()>steadyIntervals_) intervals_.erase(intervals_.begin());
+
+  bool steady=(stepSeconds_>=minStepSec_&&isSteady());
+  if (!steady&&stepSeconds_<maxStepSec_) return false;
+
+  // average over the last intervals
+  Result result;
+  result.step            =steps_[iStep_];
+  result.rate            =0.0;
+  result.throughput      =0.0;
+  result.average         =0.0;
+  result.sendLatencyUs   =0.0;
+  result.discardLatencyUs=0.0;
+  result.seconds         =stepSeconds_;
+  result.steady          =steady;
+  for (unsigned int i=0;i<intervals_.size();i++) {
+    result.rate            +=intervals_[i].rate;
+    result.throughput      +=intervals_[i].throughput;
+    result.average         +=intervals_[i].average;
+    result.sendLatencyUs   +=intervals_[i].sendLatencyUs;
+    result.discardLatencyUs+=intervals_[i].discardLatencyUs;
+  }
+  double n=intervals_.size();
+  result.rate            /=n;
+  result.throughput      /=n;
+  result.average         /=n;
+  result.sendLatencyUs   /=n;
+  result.discardLatencyUs/=n;
+  lock();
+  results_.push_back(result);
+  unlock();
+
+  intervals_.clear();
+  stepSeconds_=0.0;
+  if (++iStep_>=steps_.size()) { active_=false; iStep_=0; }
+  return true;
+}
+
+
+//______________________________________________________________________________
+void LoadScan::results(vector<Result>& results)
+{
+  lock();
+  results=results_;
+  unlock();
+}
+
+
+//______________________________________________________________________________
+void LoadScan::writeTable(ostream& out,const vector<Result>& results)
+{
+  out<<"# fedSize targetRateHz rateHz throughputMBps eventSize "
+     <<"sendLatencyUs discardLatencyUs seconds steady\n";
+  for (unsigned int i=0;i<results.size();i++) {
+    const Result& r=results[i];
+    out<<r.step.fedSize<<" "<<r.step.rate<<" "<<r.rate<<" "
+       <<r.throughput/1048576.0<<" "<<r.average<<" "
+       <<r.sendLatencyUs<<" "<<r.discardLatencyUs<<" "
+       <<r.seconds<<" "<<(r.steady ? 1 : 0)<<"\n";
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// implementation of private member functions
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+bool LoadScan::isSteady() const
+{
+  if (intervals_.size()<steadyIntervals_) return false;
+  double minRate=intervals_[0].rate;
+  double maxRate=intervals_[0].rate;
+  double sum    =0.0;
+  for (unsigned int i=0;i<intervals_.size();i++) {
+    minRate=std::min(minRate,intervals_[i].rate);
+    maxRate=std::max(maxRate,intervals_[i].rate);
+    sum+=intervals_[i].rate;
+  }
+  double mean=sum/intervals_.size();
+  return mean>0.0&&(maxRate-minRate)<=tolerance_*mean;
+}
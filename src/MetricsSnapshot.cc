@@ -0,0 +1,244 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// MetricsSnapshot
+// ---------------
+//
+// Lock-free copy of the BU monitoring values for the metrics web page.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "EventFilter/AutoBU/interface/MetricsSnapshot.h"
+
+#include <cstring>
+#include <cmath>
+#include <sched.h>
+
+
+using namespace std;
+using namespace evf;
+
+
+namespace {
+
+  struct MetricInfo
+  {
+    const char* jsonName;   // as the monitor parameter, if any
+    const char* omName;
+    const char* type;
+    const char* help;
+  };
+
+  // in the order of MetricsSnapshot::Metric
+  const MetricInfo metricInfos[MetricsSnapshot::N_METRICS]={
+    {"nbEvtsInBU",        "autobu_events_in_bu",       "gauge",  "events requested by the FU and not yet sent"},
+    {"nbEvtsRequested",   "autobu_events_requested",   "counter","events requested by the FU"},
+    {"nbEvtsBuilt",       "autobu_events_built",       "counter","events built"},
+    {"nbEvtsSent",        "autobu_events_sent",        "counter","events sent to the FU"},
+    {"nbEvtsDiscarded",   "autobu_events_discarded",   "counter","events discarded by the FU"},
+    {"nbSlotsReclaimed",  "autobu_slots_reclaimed",    "counter","slots reclaimed after the discard timeout"},
+    {"nbLateDiscards",    "autobu_late_discards",      "counter","discards of reclaimed slots"},
+    {"nbChainErrors",     "autobu_chain_errors",       "counter","invalid i2o chains found by the validator"},
+    {"rate",              "autobu_rate_hz",            "gauge",  "events sent per second"},
+    {"throughput",        "autobu_throughput_bytes",   "gauge",  "bytes sent per second"},
+    {"average",           "autobu_event_size_bytes",   "gauge",  "average event size"},
+    {"rms",               "autobu_event_size_rms_bytes","gauge", "rms of the event size"},
+    {"freeSlots",         "autobu_free_slots",         "gauge",  "slots waiting to be built"},
+    {"builtSlots",        "autobu_built_slots",        "gauge",  "built events waiting to be sent"},
+    {"sentSlots",         "autobu_sent_slots",         "gauge",  "events sent and not yet discarded"},
+    {"pendingRequests",   "autobu_pending_requests",   "gauge",  "FU requests waiting for an event"},
+    {"parkedSlots",       "autobu_parked_slots",       "gauge",  "slots parked by the adaptive depth"},
+    {"activeDepth",       "autobu_active_depth",       "gauge",  "slots in flight"},
+    {"eventMemInMB",      "autobu_event_memory_mb",    "gauge",  "event memory in use"},
+    {"eventMemPeakInMB",  "autobu_event_memory_peak_mb","gauge", "peak event memory in use"},
+    {"replayCacheInMB",   "autobu_replay_cache_mb",    "gauge",  "compressed size of the replay cache"},
+    {"sendLatencyAvgUs",  "autobu_send_latency_avg_us","gauge",  "average time from built to posted"},
+    {"sendLatencyPeakUs", "autobu_send_latency_peak_us","gauge", "peak time from built to posted"},
+    {"eventsPerPost",     "autobu_events_per_post",    "gauge",  "events per posted chain"}
+  };
+
+  const unsigned int maxReadRetries=1000;
+
+
+  //____________________________________________________________________________
+  void writeJsonHistogram(ostream& out,const char* name,
+			  const uint64_t* bins,uint64_t sumUs)
+  {
+    uint64_t count=0;
+    out<<"\""<<name<<"\":{\"le\":[";
+    for (unsigned int i=0;i<LatencyHistogram::nBins;i++) {
+      if (i>0) out<<",";
+      if (i<LatencyHistogram::nBins-1) out<<LatencyHistogram::upperEdge(i);
+      else out<<"\"+Inf\"";
+    }
+    out<<"],\"counts\":[";
+    for (unsigned int i=0;i<LatencyHistogram::nBins;i++) {
+      out<<((i>0) ? "," : "")<<bins[i];
+      count+=bins[i];
+    }
+    out<<"],\"count\":"<<count<<",\"sum\":"<<sumUs<<"}";
+  }
+
+
+  //____________________________________________________________________________
+  void writeOpenMetricsHistogram(ostream& out,const char* name,const char* help,
+				 const string& labels,
+				 const uint64_t* bins,uint64_t sumUs)
+  {
+    uint64_t count=0;
+    out<<"# TYPE "<<name<<" histogram\n"
+       <<"# HELP "<<name<<" "<<help<<"\n";
+    for (unsigned int i=0;i<LatencyHistogram::nBins;i++) {
+      count+=bins[i];
+      out<<name<<"_bucket{"<<labels<<",le=\"";
+      if (i<LatencyHistogram::nBins-1) out<<LatencyHistogram::upperEdge(i);
+      else out<<"+Inf";
+      out<<"\"} "<<count<<"\n";
+    }
+    out<<name<<"_count{"<<labels<<"} "<<count<<"\n"
+       <<name<<"_sum{"<<labels<<"} "<<sumUs<<"\n";
+  }
+
+} // namespace
+
+
+////////////////////////////////////////////////////////////////////////////////
+// construction/destruction
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+LatencyHistogram::LatencyHistogram()
+{
+  reset();
+}
+
+
+//______________________________________________________________________________
+LatencyHistogram::~LatencyHistogram()
+{
+
+}
+
+
+//______________________________________________________________________________
+MetricsSnapshot::MetricsSnapshot()
+  : seq_(0)
+{
+  memset(&data_,0,sizeof(data_));
+}
+
+
+//______________________________________________________________________________
+MetricsSnapshot::~MetricsSnapshot()
+{
+
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// implementation of member functions
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+void LatencyHistogram::add(double us)
+{
+  unsigned int bin=0;
+  if (us>=1.0) {
+    int exponent;
+    frexp(us,&exponent);
+    bin=(exponent<(int)nBins) ? exponent : nBins-1;
+  }
+  __sync_fetch_and_add(&bins_[bin],1);
+  __sync_fetch_and_add(&sumUs_,(uint64_t)us);
+}
+
+
+//______________________________________________________________________________
+void LatencyHistogram::read(uint64_t* bins,uint64_t& sumUs) const
+{
+  for (unsigned int i=0;i<nBins;i++) bins[i]=bins_[i];
+  sumUs=sumUs_;
+}
+
+
+//______________________________________________________________________________
+void LatencyHistogram::reset()
+{
+  for (unsigned int i=0;i<nBins;i++) bins_[i]=0;
+  sumUs_=0;
+}
+
+
+//______________________________________________________________________________
+double LatencyHistogram::upperEdge(unsigned int i)
+{
+  return (i<nBins-1) ? ldexp(1.0,i) : 0.0;
+}
+
+
+//______________________________________________________________________________
+void MetricsSnapshot::publish(const Data& data)
+{
+  __sync_fetch_and_add(&seq_,1);
+  __sync_synchronize();
+  memcpy(&data_,&data,sizeof(data_));
+  __sync_synchronize();
+  __sync_fetch_and_add(&seq_,1);
+}
+
+
+//______________________________________________________________________________
+bool MetricsSnapshot::read(Data& data) const
+{
+  for (unsigned int i=0;i<maxReadRetries;i++) {
+    uint32_t seq=seq_;
+    if (seq&1) { sched_yield(); continue; }
+    __sync_synchronize();
+    memcpy(&data,&data_,sizeof(data));
+    __sync_synchronize();
+    if (seq_==seq) return seq>0;
+  }
+  return false;
+}
+
+
+//______________________________________________________________________________
+void MetricsSnapshot::writeJson(ostream& out,const Data& data,
+				const string& source)
+{
+  streamsize precision=out.precision(15);
+  out<<"{\"source\":\""<<source<<"\",\"timestamp\":"<<data.timestamp
+     <<",\"metrics\":{";
+  for (unsigned int i=0;i<N_METRICS;i++)
+    out<<((i>0) ? "," : "")<<"\""<<metricInfos[i].jsonName<<"\":"<<data.values[i];
+  out<<"},\"histograms\":{";
+  writeJsonHistogram(out,"sendLatencyUs",data.sendLatency,data.sendLatencySumUs);
+  out<<",";
+  writeJsonHistogram(out,"discardLatencyUs",data.discardLatency,data.discardLatencySumUs);
+  out<<"}}\n";
+  out.precision(precision);
+}
+
+
+//______________________________________________________________________________
+void MetricsSnapshot::writeOpenMetrics(ostream& out,const Data& data,
+				       const string& source)
+{
+  streamsize precision=out.precision(15);
+  string labels="source=\""+source+"\"";
+  for (unsigned int i=0;i<N_METRICS;i++) {
+    const MetricInfo& info=metricInfos[i];
+    bool isCounter=(0==strcmp(info.type,"counter"));
+    out<<"# TYPE "<<info.omName<<" "<<info.type<<"\n"
+       <<"# HELP "<<info.omName<<" "<<info.help<<"\n"
+       <<info.omName<<(isCounter ? "_total" : "")<<"{"<<labels<<"} "
+       <<data.values[i]<<"\n";
+  }
+  writeOpenMetricsHistogram(out,"autobu_send_latency_us",
+			    "time from built to posted",labels,
+			    data.sendLatency,data.sendLatencySumUs);
+  writeOpenMetricsHistogram(out,"autobu_discard_latency_us",
+			    "time from sent to discarded",labels,
+			    data.discardLatency,data.discardLatencySumUs);
+  out<<"# EOF\n";
+  out.precision(precision);
+}
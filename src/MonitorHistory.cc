@@ -0,0 +1,96 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// MonitorHistory
+// --------------
+//
+// Values of the past monitoring intervals of the BU.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "EventFilter/AutoBU/interface/MonitorHistory.h"
+
+
+using namespace std;
+using namespace evf;
+
+
+////////////////////////////////////////////////////////////////////////////////
+// construction/destruction
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+MonitorHistory::MonitorHistory()
+  : next_(0)
+  , size_(0)
+{
+  sem_init(&lock_,0,1);
+}
+
+
+//______________________________________________________________________________
+MonitorHistory::~MonitorHistory()
+{
+
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// implementation of member functions
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+void MonitorHistory::configure(unsigned int capacity)
+{
+  lock();
+  ring_.assign(capacity,Entry());
+  next_=0;
+  size_=0;
+  unlock();
+}
+
+
+//______________________________________________________________________________
+void MonitorHistory::add(const Entry& entry)
+{
+  lock();
+  if (!ring_.empty()) {
+    ring_[next_]=entry;
+    next_=(next_+1)%ring_.size();
+    if (size_<ring_.size()) size_++;
+  }
+  unlock();
+}
+
+
+//______________________________________________________________________________
+void MonitorHistory::entries(vector<Entry>& entries)
+{
+  lock();
+  entries.clear();
+  entries.reserve(size_);
+  unsigned int first=(next_+ring_.size()-size_)%(ring_.empty() ? 1 : ring_.size());
+  for (unsigned int i=0;i<size_;i++)
+    entries.push_back(ring_[(first+i)%ring_.size()]);
+  unlock();
+}
+
+
+//______________________________________________________________________________
+void MonitorHistory::writeJson(ostream& out,const vector<Entry>& entries)
+{
+  streamsize precision=out.precision(15);
+  out<<"[";
+  for (unsigned int i=0;i<entries.size();i++) {
+    const Entry& e=entries[i];
+    out<<((i>0) ? ",\n" : "\n")
+       <<"{\"time\":"<<e.time<<",\"deltaT\":"<<e.deltaT
+       <<",\"rate\":"<<e.rate<<",\"throughput\":"<<e.throughput
+       <<",\"average\":"<<e.average<<",\"rms\":"<<e.rms
+       <<",\"sendLatencyUs\":"<<e.sendLatencyUs
+       <<",\"discardLatencyUs\":"<<e.discardLatencyUs
+       <<",\"fedSizeMean\":"<<e.fedSizeMean
+       <<",\"activeDepth\":"<<e.activeDepth<<"}";
+  }
+  out<<"\n]\n";
+  out.precision(precision);
+}
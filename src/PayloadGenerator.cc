@@ -0,0 +1,144 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// PayloadGenerator
+// ----------------
+//
+// Content for the feds of events generated in RANDOM mode.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "EventFilter/AutoBU/interface/PayloadGenerator.h"
+
+#include <cstring>
+#include <cmath>
+
+
+using namespace std;
+using namespace evf;
+
+
+namespace {
+
+  // mean adc value of hit channels in ZS mode
+  const double adcMean=20.0;
+
+  // xorshift64*, one independent generator per lane
+  inline uint64_t nextRandom(uint64_t& state)
+  {
+    state^=state>>12;
+    state^=state<<25;
+    state^=state>>27;
+    return state*2685821657736338717ULL;
+  }
+
+} // namespace
+
+
+////////////////////////////////////////////////////////////////////////////////
+// construction/destruction
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+PayloadGenerator::PayloadGenerator()
+  : pattern_(NONE)
+{
+  state_[0]=0x9e3779b97f4a7c15ULL;
+  state_[1]=0xbf58476d1ce4e5b9ULL;
+  state_[2]=0x94d049bb133111ebULL;
+  state_[3]=0x2545f4914f6cdd1dULL;
+}
+
+
+//______________________________________________________________________________
+PayloadGenerator::~PayloadGenerator()
+{
+
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// implementation of member functions
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+bool PayloadGenerator::configure(const string& pattern,double occupancy)
+{
+  Pattern result;
+  if      (pattern=="NONE")   result=NONE;
+  else if (pattern=="ZEROS")  result=ZEROS;
+  else if (pattern=="RANDOM") result=RANDOM;
+  else if (pattern=="ZS")     result=ZS;
+  else return false;
+
+  if (occupancy<=0.0||occupancy>1.0) return false;
+  pattern_=result;
+
+  // channel value for each 16 bit random number: the lowest 'occupancy'
+  // fraction are hits, with adc values falling off exponentially
+  unsigned int nHit=(unsigned int)(occupancy*65536.0+0.5);
+  channels_.assign(65536,0);
+  for (unsigned int i=0;i<nHit;i++) {
+    double u=(i+0.5)/nHit;
+    channels_[i]=1+(unsigned short)(-std::log(u)*adcMean);
+  }
+  return true;
+}
+
+
+//______________________________________________________________________________
+void PayloadGenerator::fill(unsigned char* data,unsigned int size)
+{
+  switch (pattern_) {
+  case NONE:   break;
+  case ZEROS:  memset(data,0,size); break;
+  case RANDOM: fillRandom(data,size); break;
+  case ZS:     fillZS(data,size); break;
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// implementation of private member functions
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+void PayloadGenerator::fillRandom(unsigned char* data,unsigned int size)
+{
+  // four independent generators keep the pipeline (and stores) busy
+  uint64_t s0=state_[0],s1=state_[1],s2=state_[2],s3=state_[3];
+  uint64_t word[4];
+  unsigned int i=0;
+  for (;i+32<=size;i+=32) {
+    word[0]=nextRandom(s0);
+    word[1]=nextRandom(s1);
+    word[2]=nextRandom(s2);
+    word[3]=nextRandom(s3);
+    memcpy(data+i,word,32);
+  }
+  for (;i<size;i+=8) {
+    word[0]=nextRandom(s0);
+    memcpy(data+i,word,(size-i<8) ? size-i : 8);
+  }
+  state_[0]=s0; state_[1]=s1; state_[2]=s2; state_[3]=s3;
+}
+
+
+//______________________________________________________________________________
+void PayloadGenerator::fillZS(unsigned char* data,unsigned int size)
+{
+  // 16 random bits per channel, mapped to its value by the table
+  uint64_t s0=state_[0],s1=state_[1];
+  uint16_t channel[8];
+  unsigned int i=0;
+  for (;i+16<=size;i+=16) {
+    uint64_t r0=nextRandom(s0);
+    uint64_t r1=nextRandom(s1);
+    for (unsigned int j=0;j<4;j++,r0>>=16,r1>>=16) {
+      channel[j]  =channels_[r0&0xffff];
+      channel[j+4]=channels_[r1&0xffff];
+    }
+    memcpy(data+i,channel,16);
+  }
+  if (i<size) memset(data+i,0,size-i);
+  state_[0]=s0; state_[1]=s1;
+}
@@ -0,0 +1,266 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// ReplayCache
+// -----------
+//
+// Keeps a large number of events in memory, each fed compressed
+// separately in the LZ4 block format, to be replayed into BUEvent slots.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "EventFilter/AutoBU/interface/ReplayCache.h"
+#include "EventFilter/AutoBU/interface/BUEvent.h"
+
+#include <cstring>
+
+
+using namespace std;
+using namespace evf;
+
+
+////////////////////////////////////////////////////////////////////////////////
+// LZ4 block format helpers
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+  const unsigned int minMatch_    =4;
+  const unsigned int lastLiterals_=5;
+  const unsigned int mfLimit_     =12;
+  const unsigned int maxOffset_   =65535;
+  const unsigned int hashLog_     =12;
+
+  inline uint32_t read32(const unsigned char* p)
+  {
+    uint32_t v; memcpy(&v,p,sizeof(v)); return v;
+  }
+
+  inline uint32_t hash32(uint32_t v)
+  {
+    return (v*2654435761U)>>(32-hashLog_);
+  }
+
+  inline unsigned char* writeLength(unsigned char* op,unsigned int len)
+  {
+    while (len>=255) { *op++=255; len-=255; }
+    *op++=(unsigned char)len;
+    return op;
+  }
+
+} // namespace
+
+
+////////////////////////////////////////////////////////////////////////////////
+// construction/destruction
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+ReplayCache::ReplayCache()
+  : rawSize_(0)
+  , compressedSize_(0)
+{
+
+}
+
+
+//______________________________________________________________________________
+ReplayCache::~ReplayCache()
+{
+  clear();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// implementation of member functions
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+void ReplayCache::clear()
+{
+  while (!events_.empty()) { delete events_.back(); events_.pop_back(); }
+  rawSize_=0;
+  compressedSize_=0;
+}
+
+
+//______________________________________________________________________________
+bool ReplayCache::add(const BUEvent* evt)
+{
+  Event* cached=new Event();
+  cached->evtNumber=evt->evtNumber();
+  for (unsigned int i=0;i<evt->nSuperFrag();i++)
+    cached->sfFirstFed.push_back(evt->superFragFirstFed(i));
+
+  for (unsigned int i=0;i<evt->nFed();i++) {
+    unsigned int fedSize=evt->fedSize(i);
+    if (work_.size()<compressBound(fedSize)) work_.resize(compressBound(fedSize));
+
+    // store feds which don't compress as they are
+    unsigned int compSize=compress(evt->fedAddr(i),fedSize,&work_[0],work_.size());
+    const unsigned char* data=&work_[0];
+    if (compSize==0||compSize>=fedSize) {
+      compSize=fedSize;
+      data    =evt->fedAddr(i);
+    }
+
+    cached->fedId.push_back(evt->fedId(i));
+    cached->fedSize.push_back(fedSize);
+    cached->compSize.push_back(compSize);
+    cached->data.insert(cached->data.end(),data,data+compSize);
+
+    rawSize_       +=fedSize;
+    compressedSize_+=compSize;
+  }
+
+  events_.push_back(cached);
+  return true;
+}
+
+
+//______________________________________________________________________________
+bool ReplayCache::fill(unsigned int i,BUEvent* evt) const
+{
+  if (i>=events_.size()) return false;
+  const Event* cached=events_[i];
+
+  evt->initialize(cached->evtNumber);
+
+  const unsigned char* src=cached->data.empty() ? 0 : &cached->data[0];
+  unsigned int iSuperFrag=0;
+  for (unsigned int iFed=0;iFed<cached->fedId.size();iFed++) {
+    while (iSuperFrag<cached->sfFirstFed.size()&&
+	   cached->sfFirstFed[iSuperFrag]==iFed) {
+      evt->startSuperFrag();
+      iSuperFrag++;
+    }
+    unsigned int fedSize =cached->fedSize[iFed];
+    unsigned int compSize=cached->compSize[iFed];
+    if (!evt->writeFed(cached->fedId[iFed],0,fedSize)) return false;
+    unsigned char* dst=evt->fedAddr(evt->nFed()-1);
+    if (compSize==fedSize) memcpy(dst,src,fedSize);
+    else if (!decompress(src,compSize,dst,fedSize)) return false;
+    src+=compSize;
+  }
+  return true;
+}
+
+
+//______________________________________________________________________________
+unsigned int ReplayCache::compress(const unsigned char* src,unsigned int srcSize,
+				   unsigned char* dst,unsigned int dstCapacity)
+{
+  if (dstCapacity<compressBound(srcSize)) return 0;
+
+  unsigned char* op    =dst;
+  unsigned int   anchor=0;
+
+  if (srcSize>mfLimit_) {
+    uint32_t table[1<<hashLog_];
+    memset(table,0,sizeof(table));
+
+    unsigned int ip        =0;
+    unsigned int limit     =srcSize-mfLimit_;
+    unsigned int matchLimit=srcSize-lastLiterals_;
+    unsigned int misses    =0;
+
+    while (ip<limit) {
+      uint32_t     seq=read32(src+ip);
+      uint32_t     h  =hash32(seq);
+      unsigned int ref=table[h];
+      table[h]=ip;
+
+      if (ref>=ip||ip-ref>maxOffset_||read32(src+ref)!=seq) {
+	// skip faster through data which doesn't compress
+	ip+=1+(misses++>>6);
+	continue;
+      }
+      misses=0;
+
+      unsigned int matchLen=minMatch_;
+      while (ip+matchLen<matchLimit&&src[ref+matchLen]==src[ip+matchLen])
+	matchLen++;
+
+      // token, literals, offset, match length
+      unsigned int   litLen=ip-anchor;
+      unsigned char* token =op++;
+      if (litLen>=15) { *token=15<<4; op=writeLength(op,litLen-15); }
+      else            { *token=(unsigned char)(litLen<<4); }
+      memcpy(op,src+anchor,litLen);
+      op+=litLen;
+
+      unsigned int offset=ip-ref;
+      *op++=(unsigned char)(offset&0xff);
+      *op++=(unsigned char)(offset>>8);
+
+      unsigned int len=matchLen-minMatch_;
+      if (len>=15) { *token|=15; op=writeLength(op,len-15); }
+      else         { *token|=(unsigned char)len; }
+
+      ip    +=matchLen;
+      anchor =ip;
+    }
+  }
+
+  // last literals
+  unsigned int   litLen=srcSize-anchor;
+  unsigned char* token =op++;
+  if (litLen>=15) { *token=15<<4; op=writeLength(op,litLen-15); }
+  else            { *token=(unsigned char)(litLen<<4); }
+  memcpy(op,src+anchor,litLen);
+  op+=litLen;
+
+  return op-dst;
+}
+
+
+//______________________________________________________________________________
+bool ReplayCache::decompress(const unsigned char* src,unsigned int srcSize,
+			     unsigned char* dst,unsigned int dstSize)
+{
+  const unsigned char* ip   =src;
+  const unsigned char* ipEnd=src+srcSize;
+  unsigned char*       op   =dst;
+  unsigned char*       opEnd=dst+dstSize;
+
+  while (ip<ipEnd) {
+    unsigned int token =*ip++;
+    unsigned int litLen=token>>4;
+    if (litLen==15) {
+      unsigned char b;
+      do { if (ip>=ipEnd) return false; b=*ip++; litLen+=b; } while (b==255);
+    }
+    if (litLen>(unsigned int)(ipEnd-ip)||litLen>(unsigned int)(opEnd-op))
+      return false;
+    memcpy(op,ip,litLen);
+    ip+=litLen;
+    op+=litLen;
+
+    // the last sequence has no match
+    if (ip==ipEnd) break;
+
+    if (ipEnd-ip<2) return false;
+    unsigned int offset=ip[0]|(ip[1]<<8);
+    ip+=2;
+    if (offset==0||offset>(unsigned int)(op-dst)) return false;
+
+    unsigned int matchLen=token&15;
+    if (matchLen==15) {
+      unsigned char b;
+      do { if (ip>=ipEnd) return false; b=*ip++; matchLen+=b; } while (b==255);
+    }
+    matchLen+=minMatch_;
+    if (matchLen>(unsigned int)(opEnd-op)) return false;
+
+    const unsigned char* match=op-offset;
+    if (offset>=matchLen) {
+      memcpy(op,match,matchLen);
+      op+=matchLen;
+    }
+    else {
+      // overlapping match, copy byte by byte
+      for (unsigned int i=0;i<matchLen;i++) *op++=*match++;
+    }
+  }
+
+  return op==opEnd;
+}
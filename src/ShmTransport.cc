@@ -0,0 +1,311 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// ShmTransport
+// ------------
+//
+// Shared memory rings for the i2o frames between a BU and a FU on one host.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "EventFilter/AutoBU/interface/ShmTransport.h"
+
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+using namespace std;
+using namespace evf;
+
+
+namespace {
+
+  const char         shmMagic[8]={'A','U','T','O','B','U','S','M'};
+  const uint32_t     shmVersion=1;
+  const uint32_t     wrapMarker=0xffffffff;
+  const unsigned int recordHeaderSize=8;
+
+  inline uint64_t padded(uint64_t size) { return (size+7)&~(uint64_t)7; }
+
+}
+
+
+// head and tail on their own cache lines, positions only ever increase
+struct ShmTransport::Ring
+{
+  volatile uint64_t head;     // written by the producer
+  char              pad0[56];
+  volatile uint64_t tail;     // written by the consumer
+  char              pad1[56];
+  uint64_t          offset;   // of the ring data from the segment start
+  uint64_t          size;     // multiple of 8
+  char              pad2[48];
+};
+
+
+struct ShmTransport::Segment
+{
+  char              magic[8]; // written last by create()
+  uint32_t          version;
+  uint32_t          reserved;
+  char              pad[48];
+  Ring              data;
+  Ring              ret;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// construction/destruction
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+ShmTransport::ShmTransport()
+  : isCreator_(false)
+  , segment_(0)
+  , segmentSize_(0)
+  , nbFramesSent_(0)
+  , nbFramesReceived_(0)
+{
+
+}
+
+
+//______________________________________________________________________________
+ShmTransport::~ShmTransport()
+{
+  close();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// implementation of member functions
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+bool ShmTransport::create(const string& name,uint64_t dataSize,uint64_t returnSize)
+{
+  close();
+  dataSize  =padded(dataSize);
+  returnSize=padded(returnSize);
+  uint64_t size=sizeof(Segment)+dataSize+returnSize;
+
+  // a segment left over by a previous run would confuse an attached FU
+  shm_unlink(name.c_str());
+  int fd=shm_open(name.c_str(),O_CREAT|O_EXCL|O_RDWR,0600);
+  if (fd<0) {
+    error_="can't create "+name+": "+strerror(errno);
+    return false;
+  }
+  if (0!=ftruncate(fd,size)) {
+    error_="can't resize "+name+": "+strerror(errno);
+    ::close(fd);
+    shm_unlink(name.c_str());
+    return false;
+  }
+  void* addr=mmap(0,size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+  ::close(fd);
+  if (MAP_FAILED==addr) {
+    error_="can't map "+name+": "+strerror(errno);
+    shm_unlink(name.c_str());
+    return false;
+  }
+
+  Segment* segment=(Segment*)addr;
+  memset(segment,0,sizeof(Segment));
+  segment->version    =shmVersion;
+  segment->data.offset=sizeof(Segment);
+  segment->data.size  =dataSize;
+  segment->ret.offset =sizeof(Segment)+dataSize;
+  segment->ret.size   =returnSize;
+  __sync_synchronize();
+  memcpy(segment->magic,shmMagic,sizeof(shmMagic));
+
+  name_            =name;
+  isCreator_       =true;
+  segment_         =segment;
+  segmentSize_     =size;
+  nbFramesSent_    =0;
+  nbFramesReceived_=0;
+  return true;
+}
+
+
+//______________________________________________________________________________
+bool ShmTransport::attach(const string& name)
+{
+  close();
+  int fd=shm_open(name.c_str(),O_RDWR,0600);
+  if (fd<0) {
+    error_="can't open "+name+": "+strerror(errno);
+    return false;
+  }
+  struct stat st;
+  if (0!=fstat(fd,&st)||(uint64_t)st.st_size<sizeof(Segment)) {
+    error_="invalid size of "+name;
+    ::close(fd);
+    return false;
+  }
+  void* addr=mmap(0,st.st_size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+  ::close(fd);
+  if (MAP_FAILED==addr) {
+    error_="can't map "+name+": "+strerror(errno);
+    return false;
+  }
+
+  Segment* segment=(Segment*)addr;
+  if (0!=memcmp(segment->magic,shmMagic,sizeof(shmMagic))||
+      segment->version!=shmVersion||
+      segment->ret.offset+segment->ret.size>(uint64_t)st.st_size) {
+    error_="no valid segment in "+name;
+    munmap(addr,st.st_size);
+    return false;
+  }
+
+  name_            =name;
+  isCreator_       =false;
+  segment_         =segment;
+  segmentSize_     =st.st_size;
+  nbFramesSent_    =0;
+  nbFramesReceived_=0;
+  return true;
+}
+
+
+//______________________________________________________________________________
+void ShmTransport::close()
+{
+  if (0==segment_) return;
+  munmap(segment_,segmentSize_);
+  if (isCreator_) shm_unlink(name_.c_str());
+  segment_    =0;
+  segmentSize_=0;
+  isCreator_  =false;
+}
+
+
+//______________________________________________________________________________
+ShmTransport::Status ShmTransport::send(toolbox::mem::Reference* chain)
+{
+  Ring* ring=&segment_->data;
+
+  // with at most one wrap, a chain fits into the empty ring if this holds
+  uint64_t total    =0;
+  uint64_t maxRecord=0;
+  for (toolbox::mem::Reference* ref=chain;0!=ref;ref=ref->getNextReference()) {
+    uint64_t record=recordHeaderSize+padded(ref->getDataSize());
+    total+=record;
+    if (record>maxRecord) maxRecord=record;
+  }
+  if (total+maxRecord>ring->size) return TOO_LARGE;
+
+  uint64_t     pos=ring->head;
+  unsigned int n  =0;
+  for (toolbox::mem::Reference* ref=chain;0!=ref;ref=ref->getNextReference(),n++) {
+    unsigned int flags=(0==ref->getNextReference()) ? LAST : 0;
+    if (!put(ring,pos,ref->getDataLocation(),ref->getDataSize(),flags))
+      return FULL;
+  }
+  __sync_synchronize();
+  ring->head=pos;
+  nbFramesSent_+=n;
+  return SENT;
+}
+
+
+//______________________________________________________________________________
+bool ShmTransport::receive(vector<unsigned char>& frame)
+{
+  unsigned int flags;
+  if (!pop(&segment_->ret,frame,flags)) return false;
+  nbFramesReceived_++;
+  return true;
+}
+
+
+//______________________________________________________________________________
+bool ShmTransport::take(vector<unsigned char>& frame,unsigned int& flags)
+{
+  if (!pop(&segment_->data,frame,flags)) return false;
+  nbFramesReceived_++;
+  return true;
+}
+
+
+//______________________________________________________________________________
+ShmTransport::Status ShmTransport::reply(const void* frame,unsigned int size)
+{
+  Ring* ring=&segment_->ret;
+  if (2*(recordHeaderSize+padded(size))>ring->size) return TOO_LARGE;
+
+  uint64_t pos=ring->head;
+  if (!put(ring,pos,frame,size,LAST)) return FULL;
+  __sync_synchronize();
+  ring->head=pos;
+  nbFramesSent_++;
+  return SENT;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// implementation of private member functions
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+unsigned char* ShmTransport::ringData(Ring* ring) const
+{
+  return (unsigned char*)segment_+ring->offset;
+}
+
+
+//______________________________________________________________________________
+bool ShmTransport::put(Ring* ring,uint64_t& pos,const void* data,
+		       unsigned int size,unsigned int flags) const
+{
+  // records never wrap: skip the end of the ring, marked for the consumer
+  uint64_t record=recordHeaderSize+padded(size);
+  uint64_t index =pos%ring->size;
+  uint64_t skip  =(index+record>ring->size) ? ring->size-index : 0;
+  uint64_t tail  =ring->tail;
+  __sync_synchronize();
+  if (pos+skip+record-tail>ring->size) return false;
+
+  if (skip>0) {
+    *(uint32_t*)(ringData(ring)+index)=wrapMarker;
+    pos+=skip;
+    index=0;
+  }
+  uint32_t* header=(uint32_t*)(ringData(ring)+index);
+  header[0]=size;
+  header[1]=flags;
+  memcpy(header+2,data,size);
+  pos+=record;
+  return true;
+}
+
+
+//______________________________________________________________________________
+bool ShmTransport::pop(Ring* ring,vector<unsigned char>& frame,
+		       unsigned int& flags)
+{
+  uint64_t tail=ring->tail;
+  if (tail==ring->head) return false;
+  __sync_synchronize();
+
+  uint64_t index=tail%ring->size;
+  if (*(uint32_t*)(ringData(ring)+index)==wrapMarker) {
+    tail+=ring->size-index;
+    index=0;
+  }
+  const uint32_t*      header=(const uint32_t*)(ringData(ring)+index);
+  const unsigned char* data  =(const unsigned char*)(header+2);
+  flags=header[1];
+  frame.assign(data,data+header[0]);
+  tail+=recordHeaderSize+padded(header[0]);
+
+  __sync_synchronize();
+  ring->tail=tail;
+  return true;
+}
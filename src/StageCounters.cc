@@ -0,0 +1,194 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// StageCounters
+// -------------
+//
+// Per stage hardware counters and cpu time of the BU threads.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "EventFilter/AutoBU/interface/StageCounters.h"
+
+#include <sstream>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+
+
+using namespace std;
+using namespace evf;
+
+
+namespace {
+
+  // per thread: counter group (-2: not opened yet, -1: not available) and
+  // calls since the last sample; the threads live as long as the process
+  __thread int          perfGroupFd=-2;
+  __thread unsigned int perfCalls  =0;
+
+  const uint64_t perfConfigs[3]={
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES
+  };
+
+
+  //____________________________________________________________________________
+  int openPerfGroup()
+  {
+    int fds[3];
+    for (unsigned int i=0;i<3;i++) {
+      struct perf_event_attr attr;
+      memset(&attr,0,sizeof(attr));
+      attr.type          =PERF_TYPE_HARDWARE;
+      attr.size          =sizeof(attr);
+      attr.config        =perfConfigs[i];
+      attr.read_format   =PERF_FORMAT_GROUP;
+      attr.exclude_kernel=1;
+      attr.exclude_hv    =1;
+      attr.disabled      =(i==0);
+      fds[i]=syscall(__NR_perf_event_open,&attr,0,-1,(i==0) ? -1 : fds[0],0);
+      if (fds[i]<0) {
+	while (i>0) close(fds[--i]);
+	return -1;
+      }
+    }
+    ioctl(fds[0],PERF_EVENT_IOC_ENABLE,PERF_IOC_FLAG_GROUP);
+    return fds[0];
+  }
+
+} // namespace
+
+
+////////////////////////////////////////////////////////////////////////////////
+// construction/destruction
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+StageCounters::StageCounters()
+  : prescale_(0)
+  , nbHwThreads_(0)
+{
+  memset((void*)totals_,0,sizeof(totals_));
+  memset(last_,0,sizeof(last_));
+}
+
+
+//______________________________________________________________________________
+StageCounters::~StageCounters()
+{
+
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// implementation of member functions
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+void StageCounters::configure(unsigned int prescale)
+{
+  prescale_=prescale;
+}
+
+
+//______________________________________________________________________________
+void StageCounters::end(Stage stage,const Sample& sample)
+{
+  Sample now;
+  if (!read(now)) return;
+  volatile uint64_t* totals=totals_[stage];
+  __sync_fetch_and_add(&totals[0],1);
+  if (sample.hasHardware&&now.hasHardware) {
+    __sync_fetch_and_add(&totals[1],1);
+    for (unsigned int i=0;i<CPU_NS;i++)
+      __sync_fetch_and_add(&totals[i+2],now.values[i]-sample.values[i]);
+  }
+  __sync_fetch_and_add(&totals[CPU_NS+2],now.values[CPU_NS]-sample.values[CPU_NS]);
+}
+
+
+//______________________________________________________________________________
+void StageCounters::delta(Stage stage,Totals& totals)
+{
+  uint64_t current[N_COUNTERS+2];
+  for (unsigned int i=0;i<N_COUNTERS+2;i++) current[i]=totals_[stage][i];
+  totals.n        =current[0]-last_[stage][0];
+  totals.nHardware=current[1]-last_[stage][1];
+  for (unsigned int i=0;i<N_COUNTERS;i++)
+    totals.values[i]=current[i+2]-last_[stage][i+2];
+  memcpy(last_[stage],current,sizeof(current));
+}
+
+
+//______________________________________________________________________________
+const char* StageCounters::stageName(Stage stage)
+{
+  switch (stage) {
+  case BUILD:    return "build";
+  case SEND:     return "send";
+  case ALLOCATE: return "allocate";
+  case DISCARD:  return "discard";
+  default:       return "unknown";
+  }
+}
+
+
+//______________________________________________________________________________
+string StageCounters::format(const Totals& totals)
+{
+  ostringstream oss;
+  oss<<"n="<<totals.n;
+  if (0==totals.n) return oss.str();
+  double n=totals.n;
+  if (totals.nHardware>0) {
+    double nHw=totals.nHardware;
+    oss<<" cycles="      <<totals.values[CYCLES]/nHw
+       <<" instructions="<<totals.values[INSTRUCTIONS]/nHw
+       <<" ipc="         <<((totals.values[CYCLES]>0) ?
+			    (double)totals.values[INSTRUCTIONS]/totals.values[CYCLES] : 0.0)
+       <<" cacheMisses=" <<totals.values[CACHE_MISSES]/nHw;
+  }
+  oss<<" cpuUs="<<totals.values[CPU_NS]/n*1e-3;
+  return oss.str();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// implementation of private member functions
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+bool StageCounters::beginSlow(Sample& sample)
+{
+  if (++perfCalls<prescale_) return false;
+  perfCalls=0;
+  if (-2==perfGroupFd) {
+    perfGroupFd=openPerfGroup();
+    if (perfGroupFd>=0) __sync_fetch_and_add(&nbHwThreads_,1);
+  }
+  return read(sample);
+}
+
+
+//______________________________________________________________________________
+bool StageCounters::read(Sample& sample)
+{
+  memset(&sample,0,sizeof(sample));
+  sample.hasHardware=(perfGroupFd>=0);
+  if (perfGroupFd>=0) {
+    // PERF_FORMAT_GROUP: number of counters, followed by their values
+    uint64_t buffer[4];
+    if (::read(perfGroupFd,buffer,sizeof(buffer))!=(ssize_t)sizeof(buffer)) return false;
+    sample.values[CYCLES]      =buffer[1];
+    sample.values[INSTRUCTIONS]=buffer[2];
+    sample.values[CACHE_MISSES]=buffer[3];
+  }
+  struct timespec ts;
+  if (0!=clock_gettime(CLOCK_THREAD_CPUTIME_ID,&ts)) return false;
+  sample.values[CPU_NS]=(uint64_t)ts.tv_sec*1000000000ULL+ts.tv_nsec;
+  return true;
+}
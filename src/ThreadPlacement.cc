@@ -0,0 +1,209 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// ThreadPlacement
+// ---------------
+//
+// Pins workloop threads to cpus / numa nodes and sets their priority.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "EventFilter/AutoBU/interface/ThreadPlacement.h"
+
+#include <sstream>
+#include <cstring>
+#include <cctype>
+#include <cstdlib>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+
+using namespace std;
+using namespace evf;
+
+
+// from <numaif.h>, which is not available everywhere
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE   (1<<1)
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+// construction/destruction
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+ThreadPlacement::ThreadPlacement()
+{
+  sem_init(&lock_,0,1);
+}
+
+
+//______________________________________________________________________________
+ThreadPlacement::~ThreadPlacement()
+{
+  sem_destroy(&lock_);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// implementation of member functions
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+bool ThreadPlacement::configure(const string& spec,string& error)
+{
+  map<string,Placement> placements;
+
+  istringstream iss(spec);
+  string entry;
+  while (getline(iss,entry,';')) {
+    // strip blanks
+    string tmp;
+    for (unsigned int i=0;i<entry.size();i++)
+      if (!isspace(entry[i])) tmp+=entry[i];
+    entry=tmp;
+    if (entry.empty()) continue;
+
+    size_t pos1=entry.find(':');
+    size_t pos2=(pos1==string::npos) ? string::npos : entry.find(':',pos1+1);
+    if (pos1==string::npos||pos1==0) {
+      error="invalid thread placement '"+entry+"', expected <name>:<cpus>[:<priority>]";
+      return false;
+    }
+
+    Placement placement;
+    placement.cpuList =entry.substr(pos1+1,pos2==string::npos ? string::npos : pos2-pos1-1);
+    placement.priority=0;
+    if (!parseCpuList(placement.cpuList,placement.cpus)) {
+      error="invalid cpu list '"+placement.cpuList+"'";
+      return false;
+    }
+    if (pos2!=string::npos) {
+      char* end=0;
+      placement.priority=strtol(entry.c_str()+pos2+1,&end,10);
+      if (*end!='\0'||placement.priority<0||
+	  placement.priority>sched_get_priority_max(SCHED_FIFO)) {
+	error="invalid priority in '"+entry+"'";
+	return false;
+      }
+    }
+    placements[entry.substr(0,pos1)]=placement;
+  }
+
+  lock();
+  placements_.swap(placements);
+  unlock();
+  return true;
+}
+
+
+//______________________________________________________________________________
+string ThreadPlacement::apply(const string& name,int index) const
+{
+  ostringstream oss;
+  pid_t     tid=syscall(SYS_gettid);
+  Placement placement;
+  Original  original;
+  lock();
+  map<string,Placement>::const_iterator it=placements_.find(name);
+  bool isListed=(it!=placements_.end());
+  if (isListed) placement=it->second;
+  map<pid_t,Original>::iterator itOrig=originals_.find(tid);
+  bool isPlaced=(itOrig!=originals_.end());
+  if (isPlaced) {
+    original=itOrig->second;
+    if (!isListed) originals_.erase(itOrig);
+  }
+  unlock();
+
+  // no longer listed: restore what the thread had, nothing to report
+  if (!isListed) {
+    if (isPlaced) {
+      pthread_setaffinity_np(pthread_self(),sizeof(original.cpus),&original.cpus);
+      pthread_setschedparam(pthread_self(),original.policy,&original.param);
+    }
+    return oss.str();
+  }
+
+  // first placement: remember the affinity / scheduling set from outside
+  if (!isPlaced) {
+    CPU_ZERO(&original.cpus);
+    pthread_getaffinity_np(pthread_self(),sizeof(original.cpus),&original.cpus);
+    pthread_getschedparam(pthread_self(),&original.policy,&original.param);
+    lock();
+    originals_[tid]=original;
+    unlock();
+  }
+
+  if (!placement.cpus.empty()) {
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    if (index<0) {
+      for (unsigned int i=0;i<placement.cpus.size();i++)
+	CPU_SET(placement.cpus[i],&cpuSet);
+      oss<<"cpus "<<placement.cpuList;
+    }
+    else {
+      int cpu=placement.cpus[index%placement.cpus.size()];
+      CPU_SET(cpu,&cpuSet);
+      oss<<"cpu "<<cpu;
+    }
+    int result=pthread_setaffinity_np(pthread_self(),sizeof(cpuSet),&cpuSet);
+    if (0!=result) oss<<" FAILED ("<<strerror(result)<<")";
+  }
+  else {
+    pthread_setaffinity_np(pthread_self(),sizeof(original.cpus),&original.cpus);
+    oss<<"any cpu";
+  }
+
+  if (placement.priority>0) {
+    struct sched_param param;
+    memset(&param,0,sizeof(param));
+    param.sched_priority=placement.priority;
+    int result=pthread_setschedparam(pthread_self(),SCHED_FIFO,&param);
+    oss<<", SCHED_FIFO "<<placement.priority;
+    if (0!=result) oss<<" FAILED ("<<strerror(result)<<")";
+  }
+  else pthread_setschedparam(pthread_self(),original.policy,&original.param);
+
+  return oss.str();
+}
+
+
+//______________________________________________________________________________
+bool ThreadPlacement::bindMemory(void* addr,uint64_t size,int node)
+{
+  if (node<0||node>=(int)(8*sizeof(unsigned long))) return false;
+  unsigned long nodeMask=1UL<<node;
+  return 0==syscall(SYS_mbind,addr,size,MPOL_PREFERRED,&nodeMask,
+		    8*sizeof(nodeMask),MPOL_MF_MOVE);
+}
+
+
+//______________________________________________________________________________
+bool ThreadPlacement::parseCpuList(const string& cpuList,vector<int>& cpus)
+{
+  cpus.clear();
+  istringstream iss(cpuList);
+  string range;
+  while (getline(iss,range,',')) {
+    if (range.empty()) continue;
+    char* end=0;
+    long first=strtol(range.c_str(),&end,10);
+    long last =first;
+    if (end==range.c_str()) return false;
+    if (*end=='-') {
+      const char* begin=end+1;
+      last=strtol(begin,&end,10);
+      if (end==begin) return false;
+    }
+    if (*end!='\0'||first<0||last<first||last>=CPU_SETSIZE) return false;
+    for (long cpu=first;cpu<=last;cpu++) cpus.push_back(cpu);
+  }
+  return true;
+}
@@ -0,0 +1,110 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// WaitStrategy
+// ------------
+//
+// Trades cpu for latency when handing events between the BU workloops.
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include "EventFilter/AutoBU/interface/WaitStrategy.h"
+
+#include <sched.h>
+#include <unistd.h>
+
+
+using namespace std;
+using namespace evf;
+
+
+namespace {
+
+  inline void cpuRelax()
+  {
+#if defined(__i386__)||defined(__x86_64__)
+    __asm__ __volatile__("pause" ::: "memory");
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+  }
+
+} // namespace
+
+
+////////////////////////////////////////////////////////////////////////////////
+// construction/destruction
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+WaitStrategy::WaitStrategy()
+  : spinCount_(0)
+  , yieldCount_(0)
+  , nbImmediate_(0)
+  , nbSpins_(0)
+  , nbYields_(0)
+  , nbSleeps_(0)
+{
+
+}
+
+
+//______________________________________________________________________________
+WaitStrategy::~WaitStrategy()
+{
+
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// implementation of member functions
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+void WaitStrategy::configure(unsigned int spinCount,unsigned int yieldCount)
+{
+  // spinning on a single cpu only delays the thread which would post
+  spinCount_ =(sysconf(_SC_NPROCESSORS_ONLN)>1) ? spinCount : 0;
+  yieldCount_=yieldCount;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// implementation of private member functions
+////////////////////////////////////////////////////////////////////////////////
+
+//______________________________________________________________________________
+void WaitStrategy::waitSlow(sem_t* sem)
+{
+  int value;
+  for (unsigned int i=0;i<spinCount_;i++) {
+    cpuRelax();
+    // only touch the semaphore for real when it looks available
+    sem_getvalue(sem,&value);
+    if (value>0&&0==sem_trywait(sem)) { nbSpins_++; return; }
+  }
+  for (unsigned int i=0;i<yieldCount_;i++) {
+    sched_yield();
+    if (0==sem_trywait(sem)) { nbYields_++; return; }
+  }
+  sem_wait(sem);
+  nbSleeps_++;
+}
+
+
+//______________________________________________________________________________
+bool WaitStrategy::timedWaitSlow(sem_t* sem,const struct timespec* deadline)
+{
+  int value;
+  for (unsigned int i=0;i<spinCount_;i++) {
+    cpuRelax();
+    sem_getvalue(sem,&value);
+    if (value>0&&0==sem_trywait(sem)) { nbSpins_++; return true; }
+  }
+  for (unsigned int i=0;i<yieldCount_;i++) {
+    sched_yield();
+    if (0==sem_trywait(sem)) { nbYields_++; return true; }
+  }
+  if (0!=sem_timedwait(sem,deadline)) return false;
+  nbSleeps_++;
+  return true;
+}